@@ -0,0 +1,25 @@
+#!/bin/bash
+# Bursts of messages traced in single mode with the default hex dump.
+#
+# The client sends BURSTS bursts of 43690 wl_surface.damage (1 MiB each) and waits for their echo.
+# Prints the elapsed time and the messages found in the dump, which must be all of them.
+#
+# usage: TRACER=path/to/wayland-tracer burst.sh BURSTS [TRACER ARGS]
+# example, as in the commit parsing frames in place:
+#   burst.sh 1; burst.sh 10
+
+source "$(dirname "$0")/common.sh"
+
+bursts=$1
+shift
+burst=43690
+
+start_compositor wayland-0
+
+start=$(date +%s%N)
+WAYLAND_DISPLAY=wayland-0 "$TRACER" -o "$XDG_RUNTIME_DIR/trace.txt" "$@" -- \
+    "$PYTHON" "$BENCH_DIR/echo-client.py" $((bursts * burst)) $burst damage 2>/dev/null
+end=$(date +%s%N)
+
+echo "elapsed $(( (end - start) / 1000000 )) ms," \
+     "$(grep -c 'Message ' "$XDG_RUNTIME_DIR/trace.txt") of $((2 * bursts * burst)) messages dumped"
@@ -0,0 +1,71 @@
+# Shared setup of the benchmark drivers, sourced by the scripts of bench/.
+#
+# TRACER is the wayland-tracer binary to measure, BENCH_BUILD the directory of the helpers built
+# with -DWAYLAND_TRACER_BENCH=ON (CMake) or -Dbench=true (meson), by default the bench directory
+# next to TRACER. Each run gets its own XDG_RUNTIME_DIR, the processes it starts are stopped on
+# exit.
+
+set -e
+
+BENCH_DIR=$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)
+: "${TRACER:?set TRACER to the wayland-tracer binary}"
+: "${BENCH_BUILD:=$(dirname "$TRACER")/bench}"
+PYTHON=${PYTHON:-python3}
+
+XDG_RUNTIME_DIR=$(mktemp -d)
+export XDG_RUNTIME_DIR
+BENCH_PIDS=()
+
+bench_cleanup()
+{
+    local pid
+
+    for pid in "${BENCH_PIDS[@]}"; do
+        kill "$pid" 2>/dev/null || true
+    done
+    wait 2>/dev/null || true
+    rm -rf "$XDG_RUNTIME_DIR"
+}
+trap bench_cleanup EXIT
+
+# wait_socket NAME: wait until the socket NAME is listening, at most 5 s
+wait_socket()
+{
+    local i
+
+    for i in $(seq 500); do
+        [ -S "$XDG_RUNTIME_DIR/$1" ] && return 0
+        sleep 0.01
+    done
+    echo "socket $1 did not show up" >&2
+    return 1
+}
+
+# start_compositor NAME [ARGS]: start the echo compositor on the socket NAME
+start_compositor()
+{
+    local name=$1
+
+    shift
+    "$PYTHON" "$BENCH_DIR/echo-compositor.py" "$name" "$@" &
+    BENCH_PIDS+=($!)
+    wait_socket "$name"
+}
+
+# start_tracer [ARGS]: start the tracer in server mode on wayland-1, in front of $WAYLAND_DISPLAY
+# (wayland-0 by default), its stderr goes to $XDG_RUNTIME_DIR/tracer.err
+start_tracer()
+{
+    WAYLAND_DISPLAY=${WAYLAND_DISPLAY:-wayland-0} LD_PRELOAD=${TRACER_PRELOAD:-} \
+        "$TRACER" -S wayland-1 "$@" 2>"$XDG_RUNTIME_DIR/tracer.err" &
+    TRACER_PID=$!
+    BENCH_PIDS+=($TRACER_PID)
+    wait_socket wayland-1
+}
+
+# stop_tracer: stop the tracer with SIGTERM, it exits through its signalfd
+stop_tracer()
+{
+    kill -TERM "$TRACER_PID"
+    wait "$TRACER_PID" 2>/dev/null || true
+}
@@ -0,0 +1,24 @@
+#!/bin/bash
+# Text rendering of a binary trace with --decode.
+#
+# Decodes the trace of FRAMES frames written by mixed-trace.py, and prints the elapsed time and the
+# SHA-256 of the output, which must not change with an optimization of the formatting.
+#
+# usage: TRACER=path/to/wayland-tracer decode.sh FRAMES [TRACER ARGS]
+# example, as in the commits of the formatter and of the object table:
+#   decode.sh 50000; decode.sh 50000 --exclude '*'
+
+source "$(dirname "$0")/common.sh"
+
+frames=$1
+shift
+
+"$PYTHON" "$BENCH_DIR/mixed-trace.py" "$frames" "$XDG_RUNTIME_DIR/mixed.wlt"
+
+start=$(date +%s%N)
+"$TRACER" --decode "$XDG_RUNTIME_DIR/mixed.wlt" -d "$BENCH_DIR/mixed.xml" \
+    -o "$XDG_RUNTIME_DIR/mixed.txt" "$@"
+end=$(date +%s%N)
+
+echo "$(stat -c %s "$XDG_RUNTIME_DIR/mixed.wlt") bytes decoded in $(( (end - start) / 1000000 )) ms," \
+     "output sha256 $(sha256sum "$XDG_RUNTIME_DIR/mixed.txt" | cut -c1-16)"
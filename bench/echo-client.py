@@ -0,0 +1,50 @@
+# Fake client for the benchmarks: sends COUNT messages in bursts of BURST and waits for the echo of
+# each burst, then prints the elapsed time to stderr. Connects to $WAYLAND_DISPLAY, or uses
+# $WAYLAND_SOCKET when started by the tracer in single mode.
+#
+# usage: echo-client.py COUNT [BURST [sync|damage|callback]]
+#   sync      wl_display.sync, 12 bytes
+#   damage    wl_surface.damage, 24 bytes
+#   callback  wl_display.sync and wl_callback.done on the new callback, a round-trip for --latency
+import os
+import socket
+import struct
+import sys
+import time
+
+count = int(sys.argv[1]) if len(sys.argv) > 1 else 100
+burst = int(sys.argv[2]) if len(sys.argv) > 2 else 1
+kind = sys.argv[3] if len(sys.argv) > 3 else "sync"
+
+if "WAYLAND_SOCKET" in os.environ:
+    sock = socket.socket(fileno=int(os.environ["WAYLAND_SOCKET"]))
+else:
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(os.path.join(os.environ["XDG_RUNTIME_DIR"],
+                              os.environ.get("WAYLAND_DISPLAY", "wayland-0")))
+
+
+def message(i):
+    if kind == "damage":
+        return struct.pack("<IIiiii", 3, (24 << 16) | 2, i, i, 10, 10)
+    if kind == "callback":
+        callback = 2 + i % 1000
+        return struct.pack("<IIIIII", 1, (12 << 16) | 0, callback, callback, (12 << 16) | 0, i)
+    return struct.pack("<III", 1, (12 << 16) | 0, 2 + i % 1000)
+
+
+start = time.perf_counter()
+sent = 0
+while sent < count:
+    n = min(burst, count - sent)
+    data = b"".join(message(sent + k) for k in range(n))
+    sock.sendall(data)
+    sent += n
+    received = 0
+    while received < len(data):
+        chunk = sock.recv(1 << 20)
+        if not chunk:
+            sys.exit("EOF from the compositor")
+        received += len(chunk)
+
+print(f"{count} messages in {(time.perf_counter() - start) * 1000:.1f} ms", file=sys.stderr)
@@ -0,0 +1,63 @@
+# Fake compositor for the benchmarks: echoes every message back to its client, with its fds.
+# With bench/echo.xml, a request comes back as the event of the same opcode on the same object.
+# BACKLOG is the backlog of the listening socket, DELAY seconds are spent after each accept() to
+# make a compositor slow to accept.
+#
+# usage: echo-compositor.py NAME [BACKLOG [DELAY]]
+import array
+import os
+import selectors
+import socket
+import sys
+import time
+
+name = sys.argv[1] if len(sys.argv) > 1 else "wayland-0"
+backlog = int(sys.argv[2]) if len(sys.argv) > 2 else 512
+delay = float(sys.argv[3]) if len(sys.argv) > 3 else 0
+path = os.path.join(os.environ["XDG_RUNTIME_DIR"], name)
+try:
+    os.unlink(path)
+except FileNotFoundError:
+    pass
+
+listener = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+listener.bind(path)
+listener.listen(backlog)
+listener.setblocking(False)
+sel = selectors.DefaultSelector()
+sel.register(listener, selectors.EVENT_READ)
+
+while True:
+    for key, _ in sel.select():
+        if key.fileobj is listener:
+            try:
+                client, _ = listener.accept()
+            except BlockingIOError:
+                continue
+            sel.register(client, selectors.EVENT_READ)
+            if delay:
+                time.sleep(delay)
+            continue
+
+        client = key.fileobj
+        try:
+            data, ancdata, _, _ = client.recvmsg(65536, socket.CMSG_SPACE(4 * 253))
+        except ConnectionResetError:
+            data = b""
+        if not data:
+            sel.unregister(client)
+            client.close()
+            continue
+
+        fds = []
+        for level, kind, cdata in ancdata:
+            if level == socket.SOL_SOCKET and kind == socket.SCM_RIGHTS:
+                fds += list(array.array("i", cdata[:len(cdata) - len(cdata) % 4]))
+
+        client.setblocking(True)
+        if fds:
+            client.sendmsg([data], [(socket.SOL_SOCKET, socket.SCM_RIGHTS, array.array("i", fds))])
+            for fd in fds:
+                os.close(fd)
+        else:
+            client.sendall(data)
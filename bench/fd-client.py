@@ -0,0 +1,54 @@
+# Fake client sending fds: COUNT wl_display.sync of bench/fd-echo.xml, each with one fd, sent in
+# bundles of BUNDLE messages per sendmsg (28 in libwayland), INFLIGHT at a time before waiting for
+# their echo. Checks that every fd comes back no later than its message, and prints the fds
+# received and the late ones to stderr.
+#
+# usage: fd-client.py COUNT [INFLIGHT [BUNDLE]]
+import array
+import os
+import socket
+import struct
+import sys
+
+count = int(sys.argv[1]) if len(sys.argv) > 1 else 1000
+inflight = int(sys.argv[2]) if len(sys.argv) > 2 else 280
+bundle = int(sys.argv[3]) if len(sys.argv) > 3 else 28
+
+if "WAYLAND_SOCKET" in os.environ:
+    sock = socket.socket(fileno=int(os.environ["WAYLAND_SOCKET"]))
+else:
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(os.path.join(os.environ["XDG_RUNTIME_DIR"],
+                              os.environ.get("WAYLAND_DISPLAY", "wayland-0")))
+
+null = os.open("/dev/null", os.O_RDONLY)
+sent = 0
+fds = 0
+late = 0
+while sent < count:
+    n = min(inflight, count - sent)
+    for k in range(0, n, bundle):
+        m = min(bundle, n - k)
+        data = b"".join(struct.pack("<III", 1, (12 << 16) | 0, 2 + (sent + k + j) % 1000)
+                        for j in range(m))
+        sock.sendmsg([data], [(socket.SOL_SOCKET, socket.SCM_RIGHTS, array.array("i", [null] * m))])
+
+    received = 0
+    burst_fds = 0
+    while received < n * 12:
+        data, ancdata, _, _ = sock.recvmsg(65536, socket.CMSG_SPACE(4 * 253))
+        if not data:
+            sys.exit("EOF from the compositor")
+        received += len(data)
+        for level, kind, cdata in ancdata:
+            if level == socket.SOL_SOCKET and kind == socket.SCM_RIGHTS:
+                for fd in array.array("i", cdata[:len(cdata) - len(cdata) % 4]):
+                    os.close(fd)
+                    burst_fds += 1
+        # the fds of the complete messages received so far must be there
+        if burst_fds < received // 12:
+            late += 1
+    fds += burst_fds
+    sent += n
+
+print(f"{count} messages, {fds} fds back, {late} late", file=sys.stderr)
@@ -0,0 +1,23 @@
+# Flooding fake client: sends COUNT wl_surface.damage requests as fast as the socket takes them,
+# then closes, and prints the byte count and the SHA-256 of what it sent.
+#
+# usage: flood-client.py COUNT
+import hashlib
+import os
+import socket
+import struct
+import sys
+
+count = int(sys.argv[1])
+sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+sock.connect(os.path.join(os.environ["XDG_RUNTIME_DIR"], os.environ["WAYLAND_DISPLAY"]))
+
+digest = hashlib.sha256()
+for base in range(0, count, 4096):
+    data = b"".join(struct.pack("<IIiiii", 3, (24 << 16) | 2, i, i, 10, 10)
+                    for i in range(base, min(count, base + 4096)))
+    sock.sendall(data)
+    digest.update(data)
+sock.close()
+
+print(f"client sent {count * 24} bytes, sha256 {digest.hexdigest()[:16]}", flush=True)
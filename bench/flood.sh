@@ -0,0 +1,39 @@
+#!/bin/bash
+# A client floods the compositor through the tracer, in server mode.
+#
+# The client sends MESSAGES wl_surface.damage (24 bytes each) as fast as it can, the compositor
+# reads CHUNK bytes every DELAY seconds. Prints what each end saw, which must match, the elapsed
+# time, the CPU time and peak RSS of the tracer, and its allocations larger than 4 KiB.
+#
+# usage: TRACER=path/to/wayland-tracer flood.sh MESSAGES CHUNK DELAY [TRACER ARGS]
+# example, as in the commit of the gradual buffer shrink:
+#   flood.sh 1000000 65536 0 -F binary -o /dev/null
+
+source "$(dirname "$0")/common.sh"
+
+messages=$1
+chunk=$2
+delay=$3
+shift 3
+
+"$PYTHON" "$BENCH_DIR/sink-compositor.py" wayland-sink "$chunk" "$delay" \
+    >"$XDG_RUNTIME_DIR/sink.out" &
+sink_pid=$!
+BENCH_PIDS+=($sink_pid)
+wait_socket wayland-sink
+
+WAYLAND_DISPLAY=wayland-sink TRACER_PRELOAD=$BENCH_BUILD/libmalloc-count.so start_tracer "$@"
+
+start=$(date +%s%N)
+WAYLAND_DISPLAY=wayland-1 "$PYTHON" "$BENCH_DIR/flood-client.py" "$messages"
+wait "$sink_pid"
+end=$(date +%s%N)
+
+read -r utime stime < <(cut -d' ' -f14,15 "/proc/$TRACER_PID/stat")
+rss=$(awk '/VmHWM/ { print $2, $3 }' "/proc/$TRACER_PID/status")
+stop_tracer
+
+cat "$XDG_RUNTIME_DIR/sink.out"
+echo "elapsed $(( (end - start) / 1000000 )) ms," \
+     "tracer cpu $(( (utime + stime) * 1000 / $(getconf CLK_TCK) )) ms, peak rss $rss"
+grep MALLOCS "$XDG_RUNTIME_DIR/tracer.err"
@@ -0,0 +1,48 @@
+#!/bin/bash
+# Flushes of the tracer to its peers, in server mode with the analyzer.
+#
+# With KIND fd, the client sends MESSAGES messages of bench/fd-echo.xml carrying one fd each, in
+# bundles of BUNDLE per sendmsg, 280 in flight (fd-client.py). With KIND damage, it streams
+# MESSAGES wl_surface.damage in bursts of BUNDLE (echo-client.py), 43690 for 1 MiB. The compositor
+# echoes them all.
+# Prints the sendmsg() calls of the tracer per 1000 forwarded messages, the messages of the client
+# and their echoes, and the report of the client.
+#
+# usage: TRACER=path/to/wayland-tracer flush.sh fd|damage MESSAGES BUNDLE [TRACER ARGS]
+# example, as in the commit coalescing the writes:
+#   for n in 1 4 28; do flush.sh fd 20000 $n --edge-triggered; done
+#   flush.sh fd 20000 1 --edge-triggered -F binary; flush.sh damage 1000000 43690 --edge-triggered
+
+source "$(dirname "$0")/common.sh"
+
+kind=$1
+messages=$2
+bundle=$3
+shift 3
+
+case $kind in
+fd)
+    protocol=$BENCH_DIR/fd-echo.xml
+    client=("$BENCH_DIR/fd-client.py" "$messages" 280 "$bundle")
+    ;;
+damage)
+    protocol=$BENCH_DIR/echo.xml
+    client=("$BENCH_DIR/echo-client.py" "$messages" "$bundle" damage)
+    ;;
+*)
+    echo "KIND is fd or damage" >&2
+    exit 1
+    ;;
+esac
+
+start_compositor wayland-0
+TRACER_PRELOAD=$BENCH_BUILD/libsyscall-count.so start_tracer -d "$protocol" -o /dev/null "$@"
+
+WAYLAND_DISPLAY=wayland-1 "$PYTHON" "${client[@]}" 2>"$XDG_RUNTIME_DIR/client.err"
+
+stop_tracer
+grep SYSCALLS "$XDG_RUNTIME_DIR/tracer.err" |
+    awk -v messages=$((2 * messages)) -v report="$(tail -n 1 "$XDG_RUNTIME_DIR/client.err")" '{
+        split($4, kv, "=")
+        printf "%.2f sendmsg per 1000 forwarded messages (%s)\n", kv[2] * 1000 / messages, report
+    }'
@@ -0,0 +1,94 @@
+/*
+ * Hex dump of messages, one vfprintf() per byte as the text output did before tracer-format.c,
+ * and with tracer_format_hex(). Both write to /dev/null through a tracer_writer.
+ *
+ * usage: format-bench [MESSAGES]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "wayland-private.h"
+#include "tracer.h"
+#include "tracer-format.h"
+#include "tracer-writer.h"
+
+static struct tracer_writer *writer;
+
+// The output of the formatter, in the tracer
+void
+tracer_output_write(struct tracer_instance *instance, const void *data, size_t count)
+{
+    tracer_writer_write(writer, data, count);
+}
+
+static void
+print(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    tracer_writer_vprintf(writer, fmt, ap);
+    va_end(ap);
+}
+
+static uint64_t
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int
+main(int argc, char *argv[])
+{
+    // sizes of the messages of a typical session
+    static const int sizes[] = { 12, 20, 24, 32, 44, 8, 20, 16 };
+    long count = argc > 1 ? atol(argv[1]) : 2000000;
+    struct tracer_formatter f;
+    unsigned char message[64];
+    uint64_t t0, t1, t2;
+    long bytes = 0, k;
+    int i, size;
+
+    writer = tracer_writer_create(open("/dev/null", O_WRONLY), TRACER_WRITER_SIZE);
+    if (writer == NULL) {
+        perror("writer");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < (int) sizeof message; i++)
+        message[i] = i * 37;
+
+    t0 = now();
+    for (k = 0; k < count; k++) {
+        size = sizes[k & 7];
+        bytes += size;
+        for (i = 0; i < size; i++)
+            print("%02x ", message[i]);
+        print("\n");
+    }
+
+    t1 = now();
+    for (k = 0; k < count; k++) {
+        tracer_format_init(&f, NULL);
+        tracer_format_hex(&f, message, sizes[k & 7]);
+        tracer_format_literal(&f, "\n");
+        tracer_format_flush(&f);
+    }
+    t2 = now();
+
+    printf("%ld bytes dumped\n", bytes);
+    printf("  vfprintf per byte  %.2f ns/byte\n", (double) (t1 - t0) / bytes);
+    printf("  formatter          %.2f ns/byte (%.1fx)\n", (double) (t2 - t1) / bytes,
+           (double) (t1 - t0) / (t2 - t1));
+
+    tracer_writer_flush(writer);
+    return EXIT_SUCCESS;
+}
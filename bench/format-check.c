@@ -0,0 +1,101 @@
+/*
+ * Compares the encoders of tracer-format.c with the printf() formats they replace: "%lf", "%i"
+ * and "%u" over a sweep of the 32-bit values, every fraction of a few integer parts for the 24.8
+ * fixed values, and "%02x " for a random hex dump. Prints the mismatches and their count, and
+ * exits with a failure if there is any.
+ *
+ * The sweep covers every value whose low byte is near 0 or 256, or whose integer part is 0 as a
+ * fixed value, and every 7th value otherwise. It takes several minutes.
+ *
+ * usage: format-check
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wayland-private.h"
+#include "tracer.h"
+#include "tracer-format.h"
+
+static char output[1 << 16];
+static size_t output_size;
+
+// The output of the formatter, in the tracer
+void
+tracer_output_write(struct tracer_instance *instance, const void *data, size_t count)
+{
+    memcpy(output + output_size, data, count);
+    output_size += count;
+}
+
+static long mismatches;
+
+static void
+compare(const char *expected, int size, int32_t value)
+{
+    if ((size_t) size == output_size && memcmp(expected, output, size) == 0)
+        return;
+
+    if (mismatches++ < 10)
+        printf("%d: expected %s, got %.*s\n", value, expected, (int) output_size, output);
+}
+
+int
+main(void)
+{
+    struct tracer_formatter f;
+    unsigned char data[5000];
+    char expected[64], *hex;
+    int32_t value, part;
+    uint64_t x;
+    int size, k, i;
+
+    for (x = 0; x < (1ull << 32); x++) {
+        value = (int32_t) (uint32_t) x;
+        if ((x & 0xff) > 3 && (x & 0xff) < 252 && ((x >> 8) & 0xffff) != 0 && x % 7 != 0)
+            continue;
+
+        tracer_format_init(&f, NULL);
+        output_size = 0;
+        tracer_format_fixed(&f, value);
+        tracer_format_int(&f, value);
+        tracer_format_uint(&f, (uint32_t) value);
+        tracer_format_flush(&f);
+        size = snprintf(expected, sizeof expected, "%lf%i%u", wl_fixed_to_double(value), value,
+                        (uint32_t) value);
+        compare(expected, size, value);
+    }
+
+    for (part = -3; part <= 3; part++) {
+        for (k = 0; k < 256; k++) {
+            value = part * 256 + k;
+            tracer_format_init(&f, NULL);
+            output_size = 0;
+            tracer_format_fixed(&f, value);
+            tracer_format_flush(&f);
+            size = snprintf(expected, sizeof expected, "%lf", wl_fixed_to_double(value));
+            compare(expected, size, value);
+        }
+    }
+
+    for (i = 0; i < (int) sizeof data; i++)
+        data[i] = rand();
+    tracer_format_init(&f, NULL);
+    output_size = 0;
+    tracer_format_hex(&f, data, sizeof data);
+    tracer_format_flush(&f);
+    hex = malloc(3 * sizeof data + 1);
+    for (i = 0, size = 0; i < (int) sizeof data; i++)
+        size += sprintf(hex + size, "%02x ", data[i]);
+    if ((size_t) size != output_size || memcmp(hex, output, size) != 0) {
+        printf("hex dump differs\n");
+        mismatches++;
+    }
+    free(hex);
+
+    printf("%ld mismatches\n", mismatches);
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,39 @@
+#!/bin/bash
+# Cost of --latency on a round-trip bound client, in single mode with the analyzer.
+#
+# The client does ROUNDTRIPS wl_display.sync round-trips answered by wl_callback.done. The runs
+# without and with --latency alternate RUNS times, to spread the noise of the machine over both.
+# Prints the elapsed time of each run.
+#
+# usage: TRACER=path/to/wayland-tracer latency-overhead.sh ROUNDTRIPS RUNS [TRACER ARGS]
+# example, as in the commit of --latency:
+#   latency-overhead.sh 30000 5
+
+source "$(dirname "$0")/common.sh"
+
+roundtrips=$1
+runs=$2
+shift 2
+
+start_compositor wayland-0
+
+run()
+{
+    local start end
+
+    start=$(date +%s%N)
+    WAYLAND_DISPLAY=wayland-0 "$TRACER" -d "$BENCH_DIR/echo.xml" -o /dev/null "$@" -- \
+        "$PYTHON" "$BENCH_DIR/echo-client.py" "$roundtrips" 1 callback 2>/dev/null
+    end=$(date +%s%N)
+    echo $(( (end - start) / 1000000 ))
+}
+
+without=()
+with=()
+for i in $(seq "$runs"); do
+    without+=($(run "$@"))
+    with+=($(run --latency "$@"))
+done
+
+echo "without --latency: ${without[*]} ms"
+echo "with --latency:    ${with[*]} ms"
@@ -0,0 +1,123 @@
+/*
+ * Interface name lookups of the analyzer, by tracer_analyzer_lookup_type() and by the linear scan
+ * of the interfaces it replaced.
+ *
+ * The protocol is synthetic: INTERFACES interfaces, each with 4 requests creating an object of
+ * another interface, written to a temporary file. Prints the time of tracer_analyzer_finalize(),
+ * which resolves the interfaces of the new_id arguments, and the time per lookup.
+ *
+ * usage: lookup-bench [INTERFACES [LOOKUPS]]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tracer-analyzer.h"
+
+static uint64_t
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+write_protocol(FILE *fp, int count)
+{
+    int i, j;
+
+    srand(1);
+    fprintf(fp, "<protocol name=\"bench\">\n"
+            "<interface name=\"wl_display\" version=\"1\"><request name=\"sync\">"
+            "<arg name=\"callback\" type=\"new_id\" interface=\"iface_0\"/></request>"
+            "</interface>\n");
+    for (i = 0; i < count; i++) {
+        fprintf(fp, "<interface name=\"iface_%d\" version=\"1\">\n", i);
+        for (j = 0; j < 4; j++)
+            fprintf(fp, "<request name=\"r%d\"><arg name=\"id\" type=\"new_id\" "
+                    "interface=\"iface_%d\"/><arg name=\"x\" type=\"uint\"/></request>\n",
+                    j, rand() % count);
+        fprintf(fp, "<event name=\"e0\"><arg name=\"x\" type=\"int\"/></event></interface>\n");
+    }
+    fprintf(fp, "</protocol>\n");
+
+    return fflush(fp);
+}
+
+// The lookup before the hash table
+static struct tracer_interface **
+lookup_linear(struct tracer_analyzer *analyzer, const char *name)
+{
+    struct tracer_interface **types;
+
+    for (types = analyzer->interfaces; *types != NULL; types++)
+        if (strcmp((*types)->name, name) == 0)
+            return types;
+
+    return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : 600;
+    long lookups = argc > 2 ? atol(argv[2]) : 2000000;
+    char path[] = "/tmp/lookup-bench-XXXXXX";
+    struct tracer_analyzer *analyzer;
+    volatile uintptr_t sink = 0;
+    char (*names)[32];
+    uint64_t t0, t1, t2, t3;
+    FILE *fp;
+    long i;
+    int fd;
+
+    fd = mkstemp(path);
+    if (fd < 0 || (fp = fdopen(fd, "w")) == NULL || write_protocol(fp, count) != 0) {
+        perror("protocol file");
+        return EXIT_FAILURE;
+    }
+
+    analyzer = tracer_analyzer_create();
+    if (analyzer == NULL || tracer_analyzer_add_protocol(analyzer, path) != 0) {
+        fprintf(stderr, "Failed to parse %s\n", path);
+        return EXIT_FAILURE;
+    }
+    fclose(fp);
+    unlink(path);
+
+    t0 = now();
+    if (tracer_analyzer_finalize(analyzer) != 0) {
+        fprintf(stderr, "Failed to finalize the protocol\n");
+        return EXIT_FAILURE;
+    }
+    t1 = now();
+
+    names = malloc(count * sizeof *names);
+    for (i = 0; i < count; i++)
+        snprintf(names[i], sizeof names[i], "iface_%ld", i);
+
+    // an odd stride visits the names in scattered order
+    t2 = now();
+    for (i = 0; i < lookups; i++)
+        sink += (uintptr_t) tracer_analyzer_lookup_type(analyzer, names[(i * 7919) % count]);
+    t3 = now();
+    printf("%d interfaces: finalize %.2f ms\n", count, (t1 - t0) / 1e6);
+    printf("  hash table   %.1f ns/lookup\n", (double) (t3 - t2) / lookups);
+
+    lookups /= 100;
+    t2 = now();
+    for (i = 0; i < lookups; i++)
+        sink += (uintptr_t) lookup_linear(analyzer, names[(i * 7919) % count]);
+    t3 = now();
+    printf("  linear scan  %.1f ns/lookup\n", (double) (t3 - t2) / lookups);
+
+    free(names);
+    return EXIT_SUCCESS;
+}
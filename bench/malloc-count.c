@@ -0,0 +1,40 @@
+/*
+ * Counts the allocations larger than 4 KiB, the size of an empty connection buffer, loaded with
+ * LD_PRELOAD into the tracer. The count is written to stderr at exit, as "MALLOCS count". Relies
+ * on the __libc_malloc() entry point of glibc.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+extern void *__libc_malloc(size_t size);
+
+static unsigned long large_malloc_count;
+
+static void
+malloc_count_report(void)
+{
+    char buf[64];
+    int len;
+
+    len = snprintf(buf, sizeof buf, "MALLOCS %lu\n", large_malloc_count);
+    if (write(STDERR_FILENO, buf, len) < 0)
+        return;
+}
+
+__attribute__((constructor))
+static void
+malloc_count_init(void)
+{
+    atexit(malloc_count_report);
+}
+
+void *
+malloc(size_t size)
+{
+    if (size > 4096)
+        __atomic_fetch_add(&large_malloc_count, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
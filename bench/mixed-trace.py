@@ -0,0 +1,57 @@
+# Writes a binary trace (see src/tracer-record.h) of a client drawing FRAMES frames: registry
+# globals and binds (strings), then per frame pointer motion and axis events (fixed), attach,
+# damage, frame and commit, a buffer release, a callback done and a delete_id. Decoded with
+# bench/mixed.xml. The content only depends on FRAMES.
+#
+# usage: mixed-trace.py FRAMES FILE
+import random
+import struct
+import sys
+
+CLIENT, SERVER = 1, 0
+
+random.seed(1)
+frames = int(sys.argv[1])
+out = open(sys.argv[2], "wb")
+# header of version 1, which every version of the decoder reads, without realtime offset
+out.write(b"WLTRACE\0" + struct.pack("<II", 1, 0))
+clock = 1000000000
+
+
+def message(object_id, opcode, signature="", *args):
+    body = b""
+    for kind, arg in zip(signature, args):
+        if kind == "s":
+            data = arg.encode() + b"\0"
+            body += struct.pack("<I", len(data)) + data + b"\0" * (-len(data) % 4)
+        elif kind == "i":
+            body += struct.pack("<i", arg)
+        else:
+            body += struct.pack("<I", arg)
+    return struct.pack("<II", object_id, ((8 + len(body)) << 16) | opcode) + body
+
+
+def record(side, messages):
+    global clock
+    data = b"".join(messages)
+    clock += 50000
+    out.write(struct.pack("<IIQHHI", 24 + len(data), 0, clock, side, 0, len(data)) + data)
+
+
+globals_ = ["wl_compositor", "wl_shm", "wl_seat", "wl_output", "xdg_wm_base",
+            "zwp_linux_dmabuf_v1", "wp_viewporter", "wl_data_device_manager"] * 4
+record(CLIENT, [message(1, 1, "u", 2)])
+record(SERVER, [message(2, 0, "usu", n, name, 1) for n, name in enumerate(globals_)])
+record(CLIENT, [message(2, 0, "usuu", 1, "wl_surface", 1, 3),
+                message(2, 0, "usuu", 2, "wl_pointer", 1, 4),
+                message(2, 0, "usuu", 3, "wl_buffer", 1, 5)])
+for frame in range(frames):
+    events = [message(4, 0, "uii", frame * 16 + k, random.randint(0, 1920 * 256),
+                      random.randint(0, 1080 * 256)) for k in range(4)]
+    if frame % 8 == 0:
+        events.append(message(4, 1, "uui", frame, 0, random.randint(-2560, 2560)))
+    record(SERVER, events)
+    record(CLIENT, [message(3, 1, "uii", 5, 0, 0),
+                    message(3, 2, "iiii", 0, 0, random.randint(1, 1920), random.randint(1, 1080)),
+                    message(3, 3, "u", 6), message(3, 4)])
+    record(SERVER, [message(5, 0), message(6, 0, "u", frame * 16), message(1, 1, "u", 6)])
@@ -0,0 +1,187 @@
+/*
+ * Object table of an instance, tracer_objects against the wl_map it replaced.
+ *
+ * Replays the same pseudo-random operations on both: about 300 live objects of the client (kept
+ * between half and twice that) and 8 of the compositor, 92% lookups of a client object, 3% new
+ * callbacks, 3% lookups followed by the removal of a client object, whose id is reused by the next
+ * callback, and 2% lookups of a compositor object. Prints the time per operation.
+ *
+ * usage: objects-bench [OPERATIONS [OBJECTS]]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "tracer-objects.h"
+#include "wayland-private.h"
+
+#define SERVER_OBJECTS 8
+#define MAX_OBJECTS 4096
+
+static uint64_t
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint32_t
+next_random(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// Live ids of the client and the ids freed for reuse, as libwayland hands them out again
+struct ids
+{
+    uint32_t live[MAX_OBJECTS];
+    uint32_t freed[MAX_OBJECTS];
+    uint32_t live_count, freed_count, next;
+};
+
+static inline uint32_t
+ids_new(struct ids *ids)
+{
+    uint32_t id = ids->freed_count > 0 ? ids->freed[--ids->freed_count] : ids->next++;
+
+    ids->live[ids->live_count++] = id;
+    return id;
+}
+
+static inline uint32_t
+ids_take(struct ids *ids, uint32_t r)
+{
+    uint32_t i = r % ids->live_count;
+    uint32_t id = ids->live[i];
+
+    ids->live[i] = ids->live[--ids->live_count];
+    ids->freed[ids->freed_count++] = id;
+    return id;
+}
+
+// One table behind the operations of run()
+struct table
+{
+    struct wl_map map;
+    struct tracer_objects objects;
+    int use_map;
+};
+
+static inline void
+table_insert(struct table *table, uint32_t id, void *interface)
+{
+    if (table->use_map) {
+        wl_map_reserve_new(&table->map, id);
+        wl_map_insert_at(&table->map, 0, id, interface);
+    }
+    else
+        tracer_objects_insert(&table->objects, id, interface);
+}
+
+static inline void *
+table_lookup(struct table *table, uint32_t id)
+{
+    return table->use_map ? wl_map_lookup(&table->map, id)
+                          : (void *) tracer_objects_lookup(&table->objects, id);
+}
+
+static inline void
+table_remove(struct table *table, uint32_t id)
+{
+    if (table->use_map)
+        wl_map_remove(&table->map, id);
+    else
+        tracer_objects_remove(&table->objects, id);
+}
+
+static double
+run(int use_map, long operations, int objects)
+{
+    static char interfaces[16];
+    static struct ids ids;
+    struct table table = { .use_map = use_map };
+    volatile uintptr_t sink = 0;
+    uint32_t state = 2463534242u, r, id;
+    uint64_t t0, t1;
+    long i;
+    int j;
+
+    if (use_map)
+        wl_map_init(&table.map, WL_MAP_CLIENT_SIDE);
+    else
+        tracer_objects_init(&table.objects);
+
+    // id 0 is never used, as in the tracer
+    table_insert(&table, 0, NULL);
+    ids.live_count = ids.freed_count = 0;
+    ids.next = 1;
+    for (j = 0; j < objects; j++) {
+        id = ids_new(&ids);
+        table_insert(&table, id, &interfaces[id % 16]);
+    }
+    for (j = 0; j < SERVER_OBJECTS; j++)
+        table_insert(&table, TRACER_SERVER_ID_START + j, &interfaces[j]);
+
+    t0 = now();
+    for (i = 0; i < operations; i++) {
+        r = next_random(&state);
+        switch (r % 100) {
+        default:
+            sink += (uintptr_t) table_lookup(&table, ids.live[(r >> 8) % ids.live_count]);
+            break;
+        case 92: case 93: case 94:
+            if (ids.live_count < 2 * (uint32_t) objects) {
+                id = ids_new(&ids);
+                table_insert(&table, id, &interfaces[id % 16]);
+            }
+            break;
+        case 95: case 96: case 97:
+            if (ids.live_count > (uint32_t) objects / 2) {
+                id = ids_take(&ids, r >> 8);
+                sink += (uintptr_t) table_lookup(&table, id);
+                table_remove(&table, id);
+            }
+            break;
+        case 98: case 99:
+            sink += (uintptr_t) table_lookup(&table,
+                                             TRACER_SERVER_ID_START + (r >> 8) % SERVER_OBJECTS);
+            break;
+        }
+    }
+    t1 = now();
+
+    if (use_map)
+        wl_map_release(&table.map);
+    else
+        tracer_objects_release(&table.objects);
+
+    return (double) (t1 - t0) / operations;
+}
+
+int
+main(int argc, char *argv[])
+{
+    long operations = argc > 1 ? atol(argv[1]) : 50000000;
+    int objects = argc > 2 ? atoi(argv[2]) : 300;
+
+    if (objects < 1 || objects > MAX_OBJECTS / 2) {
+        fprintf(stderr, "OBJECTS must be between 1 and %d\n", MAX_OBJECTS / 2);
+        return EXIT_FAILURE;
+    }
+
+    printf("%ld operations, %d objects\n", operations, objects);
+    printf("  wl_map          %.2f ns/op\n", run(1, operations, objects));
+    printf("  tracer_objects  %.2f ns/op\n", run(0, operations, objects));
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,47 @@
+# Short-lived clients, one after the other: COUNT clients, one every GAP seconds, each connects,
+# sends wl_display.sync, waits for its echo and closes. Prints how many were served and the
+# percentiles of the latency from connect() to the first byte back.
+#
+# usage: sequential-client.py COUNT GAP
+import os
+import socket
+import struct
+import sys
+import time
+
+count = int(sys.argv[1])
+gap = float(sys.argv[2])
+path = os.path.join(os.environ["XDG_RUNTIME_DIR"], os.environ.get("WAYLAND_DISPLAY", "wayland-0"))
+
+latencies = []
+errors = 0
+for i in range(count):
+    time.sleep(gap)
+    start = time.perf_counter()
+    try:
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.settimeout(5)
+        sock.connect(path)
+        sock.sendall(struct.pack("<III", 1, (12 << 16) | 0, 2))
+        received = 0
+        while received < 12:
+            data = sock.recv(64)
+            if not data:
+                raise EOFError("EOF")
+            received += len(data)
+        latencies.append(time.perf_counter() - start)
+        sock.close()
+    except Exception:
+        errors += 1
+
+latencies.sort()
+
+
+def percentile(q):
+    if not latencies:
+        return float("nan")
+    return latencies[min(len(latencies) - 1, int(q * len(latencies)))] * 1000
+
+
+print(f"{len(latencies)}/{count} served, p50 {percentile(0.5):.3f} ms, "
+      f"p90 {percentile(0.9):.3f} ms, p99 {percentile(0.99):.3f} ms")
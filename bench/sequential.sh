@@ -0,0 +1,26 @@
+#!/bin/bash
+# Short-lived clients connecting one after the other to the tracer, in server mode with the
+# analyzer.
+#
+# CLIENTS clients, one every GAP seconds (sequential-client.py), each does one wl_display.sync
+# round-trip and closes. The echo compositor spends DELAY seconds after each accept(). Prints the
+# clients served and the percentiles of their latency from connect() to the first byte back.
+#
+# usage: TRACER=path/to/wayland-tracer sequential.sh CLIENTS GAP DELAY [TRACER ARGS]
+# example, as in the commit of the upstream pool:
+#   sequential.sh 300 0.01 0; sequential.sh 300 0.01 0 --upstream-pool 4
+#   sequential.sh 300 0.01 0.002; sequential.sh 300 0.01 0.002 --upstream-pool 4
+
+source "$(dirname "$0")/common.sh"
+
+clients=$1
+gap=$2
+delay=$3
+shift 3
+
+start_compositor wayland-0 512 "$delay"
+start_tracer -d "$BENCH_DIR/echo.xml" -o /dev/null "$@"
+
+WAYLAND_DISPLAY=wayland-1 "$PYTHON" "$BENCH_DIR/sequential-client.py" "$clients" "$gap"
+
+stop_tracer
@@ -0,0 +1,37 @@
+#!/bin/bash
+# System calls of the event loop per forwarded message, in server mode.
+#
+# CLIENTS echo clients connect at once to the tracer, each does ROUNDTRIPS wl_display.sync
+# round-trips through the echo compositor, so 2 * CLIENTS * ROUNDTRIPS messages are forwarded.
+# Prints the epoll_wait(), recvmsg() and sendmsg() calls of the tracer and their sum per message.
+#
+# usage: TRACER=path/to/wayland-tracer server-syscalls.sh CLIENTS ROUNDTRIPS [TRACER ARGS]
+# example, as in the commit of the batched epoll loop:
+#   for n in 1 8 40; do server-syscalls.sh $n 200; done
+
+source "$(dirname "$0")/common.sh"
+
+clients=$1
+roundtrips=$2
+shift 2
+
+start_compositor wayland-0
+TRACER_PRELOAD=$BENCH_BUILD/libsyscall-count.so start_tracer -o /dev/null "$@"
+
+pids=()
+for i in $(seq "$clients"); do
+    WAYLAND_DISPLAY=wayland-1 "$PYTHON" "$BENCH_DIR/echo-client.py" "$roundtrips" 2>/dev/null &
+    pids+=($!)
+done
+for pid in "${pids[@]}"; do
+    wait "$pid"
+done
+
+stop_tracer
+grep SYSCALLS "$XDG_RUNTIME_DIR/tracer.err" |
+    awk -v clients="$clients" -v messages=$((2 * clients * roundtrips)) '{
+        total = 0
+        for (i = 2; i <= NF; i++) { split($i, kv, "="); total += kv[2] }
+        printf "%d clients, %d messages: %s, %.2f per message\n", clients, messages,
+               substr($0, 10), total / messages
+    }'
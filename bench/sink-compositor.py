@@ -0,0 +1,34 @@
+# Slow fake compositor: accepts one client, reads CHUNK bytes every DELAY seconds and never
+# answers, then prints the byte count and the SHA-256 of the stream once the client is gone.
+#
+# usage: sink-compositor.py NAME CHUNK DELAY
+import hashlib
+import os
+import socket
+import sys
+import time
+
+name, chunk, delay = sys.argv[1], int(sys.argv[2]), float(sys.argv[3])
+path = os.path.join(os.environ["XDG_RUNTIME_DIR"], name)
+try:
+    os.unlink(path)
+except FileNotFoundError:
+    pass
+
+listener = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+listener.bind(path)
+listener.listen(16)
+client, _ = listener.accept()
+
+digest = hashlib.sha256()
+total = 0
+while True:
+    data = client.recv(chunk)
+    if not data:
+        break
+    digest.update(data)
+    total += len(data)
+    if delay > 0:
+        time.sleep(delay)
+
+print(f"compositor received {total} bytes, sha256 {digest.hexdigest()[:16]}", flush=True)
@@ -0,0 +1,68 @@
+# Connection storm: COUNT client threads connect at the same instant, each sends wl_display.sync
+# and waits for its echo. Prints how many were served, the errors, and the percentiles of the
+# latency from connect() to the first byte back.
+#
+# With CONNECT nonblock, the default, a full backlog is an immediate error (EAGAIN), as for a
+# non-blocking client. With block, connect() waits for room in the backlog.
+#
+# usage: storm-client.py COUNT [block|nonblock]
+import os
+import socket
+import struct
+import sys
+import threading
+import time
+
+count = int(sys.argv[1])
+block = len(sys.argv) > 2 and sys.argv[2] == "block"
+path = os.path.join(os.environ["XDG_RUNTIME_DIR"], os.environ.get("WAYLAND_DISPLAY", "wayland-0"))
+
+latencies = []
+errors = {}
+lock = threading.Lock()
+barrier = threading.Barrier(count)
+
+
+def run():
+    barrier.wait()
+    start = time.perf_counter()
+    try:
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        # a timeout makes the socket non-blocking underneath
+        if not block:
+            sock.settimeout(30)
+        sock.connect(path)
+        sock.sendall(struct.pack("<III", 1, (12 << 16) | 0, 2))
+        received = 0
+        while received < 12:
+            data = sock.recv(64)
+            if not data:
+                raise EOFError("EOF")
+            received += len(data)
+        latency = time.perf_counter() - start
+        sock.close()
+        with lock:
+            latencies.append(latency)
+    except Exception as e:
+        with lock:
+            errors[type(e).__name__] = errors.get(type(e).__name__, 0) + 1
+
+
+threads = [threading.Thread(target=run) for _ in range(count)]
+for thread in threads:
+    thread.start()
+for thread in threads:
+    thread.join()
+
+latencies.sort()
+
+
+def percentile(q):
+    if not latencies:
+        return float("nan")
+    return latencies[min(len(latencies) - 1, int(q * len(latencies)))] * 1000
+
+
+print(f"{len(latencies)}/{count} served, errors {errors or 'none'}, "
+      f"p50 {percentile(0.5):.1f} ms, p90 {percentile(0.9):.1f} ms, "
+      f"p99 {percentile(0.99):.1f} ms, max {percentile(1.0):.1f} ms")
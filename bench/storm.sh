@@ -0,0 +1,27 @@
+#!/bin/bash
+# A storm of clients connecting at once to the tracer, in server mode with the analyzer.
+#
+# CLIENTS clients connect at the same instant, non-blocking or blocking (storm-client.py), each
+# does one wl_display.sync round-trip. The echo compositor listens with a backlog of BACKLOG and
+# spends DELAY seconds after each accept(). Prints the clients served and the percentiles of their
+# latency from connect() to the first byte back.
+#
+# usage: TRACER=path/to/wayland-tracer storm.sh CLIENTS block|nonblock BACKLOG DELAY [TRACER ARGS]
+# example, as in the commit accepting client storms:
+#   storm.sh 200 nonblock 512 0; storm.sh 200 block 512 0
+#   storm.sh 200 nonblock 8 0.001; storm.sh 200 block 8 0.001
+
+source "$(dirname "$0")/common.sh"
+
+clients=$1
+connect=$2
+backlog=$3
+delay=$4
+shift 4
+
+start_compositor wayland-0 "$backlog" "$delay"
+start_tracer -d "$BENCH_DIR/echo.xml" -o /dev/null "$@"
+
+WAYLAND_DISPLAY=wayland-1 "$PYTHON" "$BENCH_DIR/storm-client.py" "$clients" "$connect"
+
+stop_tracer
@@ -0,0 +1,66 @@
+/*
+ * Counts the system calls of the forwarding path, loaded with LD_PRELOAD into the tracer. The
+ * counts are written to stderr at exit, as "SYSCALLS name=count ...".
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static unsigned long epoll_wait_count, recvmsg_count, sendmsg_count;
+
+static void
+syscall_count_report(void)
+{
+    char buf[256];
+    int len;
+
+    len = snprintf(buf, sizeof buf, "SYSCALLS epoll_wait=%lu recvmsg=%lu sendmsg=%lu\n",
+                   epoll_wait_count, recvmsg_count, sendmsg_count);
+    if (write(STDERR_FILENO, buf, len) < 0)
+        return;
+}
+
+__attribute__((constructor))
+static void
+syscall_count_init(void)
+{
+    atexit(syscall_count_report);
+}
+
+int
+epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+    static int (*real)(int, struct epoll_event *, int, int);
+
+    if (real == NULL)
+        real = (int (*)(int, struct epoll_event *, int, int)) dlsym(RTLD_NEXT, "epoll_wait");
+    __atomic_fetch_add(&epoll_wait_count, 1, __ATOMIC_RELAXED);
+    return real(epfd, events, maxevents, timeout);
+}
+
+ssize_t
+recvmsg(int fd, struct msghdr *msg, int flags)
+{
+    static ssize_t (*real)(int, struct msghdr *, int);
+
+    if (real == NULL)
+        real = (ssize_t (*)(int, struct msghdr *, int)) dlsym(RTLD_NEXT, "recvmsg");
+    __atomic_fetch_add(&recvmsg_count, 1, __ATOMIC_RELAXED);
+    return real(fd, msg, flags);
+}
+
+ssize_t
+sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+    static ssize_t (*real)(int, const struct msghdr *, int);
+
+    if (real == NULL)
+        real = (ssize_t (*)(int, const struct msghdr *, int)) dlsym(RTLD_NEXT, "sendmsg");
+    __atomic_fetch_add(&sendmsg_count, 1, __ATOMIC_RELAXED);
+    return real(fd, msg, flags);
+}
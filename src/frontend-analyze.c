@@ -21,6 +21,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "wayland-private.h"
@@ -28,6 +29,12 @@
 #include "tracer.h"
 #include "frontend-analyze.h"
 #include "tracer-analyzer.h"
+#include "tracer-cache.h"
+#include "tracer-clock.h"
+#include "tracer-filter.h"
+#include "tracer-format.h"
+#include "tracer-latency.h"
+#include "tracer-stats.h"
 
 /**************************************************************************************************/
 
@@ -44,6 +51,21 @@ div_roundup(uint32_t n, size_t a)
 
 /**************************************************************************************************/
 
+static struct tracer_message *
+analyze_find_delete_id(struct tracer_analyzer *analyzer)
+{
+    struct tracer_interface *display = analyzer->display_interface;
+
+    for (int i = 0; i < display->event_count; i++) {
+        struct tracer_message *event = display->events[i];
+        if (!strcmp(event->name, "delete_id") && event->plan->arg_count == 1 &&
+            event->plan->args[0].kind == TRACER_ARG_UINT)
+            return event;
+    }
+
+    return NULL;
+}
+
 static int
 analyze_init(struct tracer *tracer)
 {
@@ -56,113 +78,194 @@ analyze_init(struct tracer *tracer)
 
     struct protocol_file *file;
     struct tracer_options *options = tracer->options;
-    wl_list_for_each(file, &options->protocol_file_list, link) {
-        if (tracer_analyzer_add_protocol(analyzer, file->loc) != 0) {
-            fprintf(stderr, "failed to add file %s\n", file->loc);
+    int count = wl_list_length(&options->protocol_file_list);
+    const char **files = malloc(count * sizeof *files);
+    if (files == NULL) {
+        fprintf(stderr, "Failed to alloc for protocols: %m\n");
+        return -1;
+    }
+
+    int i = 0;
+    wl_list_for_each(file, &options->protocol_file_list, link)
+        files[i++] = file->loc;
+
+    tracer->frontend_data = analyzer;
+
+    // skip the parsing when the tables of these files are in the cache
+    if (!options->protocol_cache || tracer_cache_load(analyzer, files, count) != 0) {
+        if (tracer_analyzer_add_protocols(analyzer, files, count) != 0 ||
+            tracer_analyzer_finalize(analyzer) != 0) {
+            free(files);
             return -1;
         }
+
+        if (options->protocol_cache)
+            tracer_cache_save(analyzer, files, count);
     }
+    free(files);
 
-    if (tracer_analyzer_finalize(analyzer) != 0)
-        return -1;
+    analyzer->delete_id = analyze_find_delete_id(analyzer);
 
-    tracer->frontend_data = analyzer;
+    if (!wl_list_empty(&options->filter_rule_list)) {
+        tracer->filter = tracer_filter_create(analyzer, &options->filter_rule_list);
+        if (tracer->filter == NULL) {
+            fprintf(stderr, "Failed to create message filter: %m\n");
+            return -1;
+        }
+    }
+
+    if (options->stats) {
+        tracer->stats = tracer_stats_create(analyzer, options->stats_top);
+        if (tracer->stats == NULL) {
+            fprintf(stderr, "Failed to create statistics: %m\n");
+            return -1;
+        }
+    }
+
+    if (options->latency) {
+        tracer->latency = tracer_latency_create(analyzer, options->latency_json);
+        if (tracer->latency == NULL) {
+            fprintf(stderr, "Failed to create latency histograms: %m\n");
+            return -1;
+        }
+    }
 
     return 0;
 }
 
 /**************************************************************************************************/
 
+// Fds of a message are either taken from a live connection and forwarded to its peer, or read from
+// a recorded array
+struct analyze_fds
+{
+    struct wl_connection *from;
+    struct wl_connection *to;
+    const int32_t *fds;
+    int count;
+    int index;
+};
+
+static int32_t
+analyze_next_fd(struct analyze_fds *fds)
+{
+    int32_t fd;
+
+    if (fds->from != NULL) {
+        ring_buffer_copy(&fds->from->fds_in, &fd, sizeof fd);
+        fds->from->fds_in.tail += sizeof fd;
+        wl_connection_put_fd(fds->to, fd);
+        return fd;
+    }
+
+    if (fds->index < fds->count)
+        return fds->fds[fds->index++];
+
+    return -1;
+}
+
+/**************************************************************************************************/
+
+// Decode and log a message, its lengths already checked by tracer_plan_check()
 static int
-analyze_protocol(struct tracer_connection *connection,
-                 uint32_t size,
-                 struct wl_map *objects,
+analyze_protocol(struct tracer_instance *instance,
+                 int side,
+                 const char *buf,
+                 struct tracer_objects *objects,
                  struct tracer_interface *target,
                  uint32_t id,
-                 struct tracer_message *message)
+                 struct tracer_message *message,
+                 struct analyze_fds *fds)
 {
     uint32_t length, new_id;
     int fd;
     char *type_name;
-    char buf[4096];
-    uint32_t *p = (uint32_t *) buf + 2;
-    struct tracer_connection *peer = connection->peer;
-    struct tracer_instance *instance = connection->instance;
-    struct tracer *tracer = connection->instance->tracer;
+    const uint32_t *words = (const uint32_t *) buf;
+    const uint32_t *p = words + 2;
+    struct tracer *tracer = instance->tracer;
 
     struct tracer_analyzer * analyzer = (struct tracer_analyzer *) tracer->frontend_data;
 
-    wl_connection_copy(connection->wl_conn, buf, size);
     if (target == NULL)
-        goto finish;
+        return 0;
 
-    size_t count = strlen(message->signature);
+    const struct tracer_plan *plan = message->plan;
+    struct tracer_formatter f;
 
     // "%s %s@%u.%s("
     tracer_log("%s \x1b[31m%s\x1b[32m@%u\x1b[34m.%s\x1b[0m(",
-               connection->side == TRACER_CLIENT_SIDE ? "<-" : "->",
+               side == TRACER_CLIENT_SIDE ? "<-" : "->",
                target->name, id, message->name);
 
-    const char * signature = message->signature;
-    {
-        tracer_log_cont(signature);
-        tracer_log_cont(" -> ");
-    }
-    signature = message->signature;
-    for (size_t i = 0; i < count; i++, signature++) {
-        if (i != 0)
-            tracer_log_cont(", ");
+    // the arguments are formatted by hand, this is the hot path of the text output
+    tracer_format_init(&f, instance);
 
-        switch (*signature) {
-        case 'u': // 32-bit unsigned integer
-            tracer_log_cont("%u", *p++);
+    tracer_format_bytes(&f, message->signature, plan->signature_length);
+    tracer_format_literal(&f, " -> ");
+
+    for (int i = 0; i < plan->arg_count; i++) {
+        const struct tracer_plan_arg *arg = &plan->args[i];
+
+        if (i != 0)
+            tracer_format_literal(&f, ", ");
+        // leading arguments are at a known place
+        if (i < plan->fixed_count)
+            p = words + arg->slot;
+
+        switch (arg->kind) {
+        case TRACER_ARG_UINT: // 32-bit unsigned integer
+            tracer_format_uint(&f, *p++);
             break;
-        case 'i': // 32-bit signed integer
-            tracer_log_cont("%i", *p++);
+        case TRACER_ARG_INT: // 32-bit signed integer
+            tracer_format_int(&f, *p++);
             break;
-        case 'f': // fixed: 24.8 bit signed fixed-point numbers
-            tracer_log_cont("%lf", wl_fixed_to_double(*p++));
+        case TRACER_ARG_FIXED: // fixed: 24.8 bit signed fixed-point numbers
+            tracer_format_fixed(&f, *p++);
             break;
-        case 's': // string
+        case TRACER_ARG_STRING: // string
             // prefixed with a 32-bit integer specifying its length (in bytes),
             // followed by the string contents and a NUL terminator,
             // padded to 32 bits with undefined data
             length = *p++;
-            if (length == 0)
-                tracer_log_cont("(null)");
-            else
-                tracer_log_cont("\"%s\"", (char *) p);
+            if (length == 0) {
+                tracer_format_literal(&f, "(null)");
+            }
+            else {
+                tracer_format_literal(&f, "\"");
+                tracer_format_string(&f, (const char *) p);
+                tracer_format_literal(&f, "\"");
+            }
             p += div_roundup(length, sizeof *p);
             break;
-        case 'o': // object: 32-bit object ID
-            tracer_log_cont("obj %u", *p++);
+        case TRACER_ARG_OBJECT: // object: 32-bit object ID
+            tracer_format_literal(&f, "obj ");
+            tracer_format_uint(&f, *p++);
             break;
-        case 'n': // new_id 32-bit object ID
+        case TRACER_ARG_NEW_ID: // new_id 32-bit object ID
             // e.g. wl_display::get_registry(registry: new_id<wl_registry>)
             new_id = *p++;
-            if (new_id != 0) {
-                wl_map_reserve_new(objects, new_id);
-                wl_map_insert_at(objects, 0, new_id, message->types[0]);
-            }
-            tracer_log_cont("new_id %u", new_id);
+            if (new_id != 0)
+                tracer_objects_insert(objects, new_id, message->types[0]);
+            tracer_format_literal(&f, "new_id ");
+            tracer_format_uint(&f, new_id);
             break;
-        case 'a': // A blob of arbitrary data
+        case TRACER_ARG_ARRAY: // A blob of arbitrary data
             // prefixed with a 32-bit integer specifying its length (in bytes),
             // then the verbatim contents of the array,
             // padded to 32 bits with undefined data
             length = *p++;
-            tracer_log_cont("array: %u", length);
+            tracer_format_literal(&f, "array: ");
+            tracer_format_uint(&f, length);
             p += div_roundup(length, sizeof *p);
             break;
-        case 'h': // fd: 0-bit value on the primary transport,
+        case TRACER_ARG_FD: // fd: 0-bit value on the primary transport,
             // but transfers a file descriptor to the other end using the ancillary data in the Unix
             // domain socket message (msg_control).
-            ring_buffer_copy(&connection->wl_conn->fds_in, &fd, sizeof fd);
-            connection->wl_conn->fds_in.tail += sizeof fd;
-            tracer_log_cont("fd %d", fd);
-            wl_connection_put_fd(peer->wl_conn, fd);
+            fd = analyze_next_fd(fds);
+            tracer_format_literal(&f, "fd ");
+            tracer_format_int(&f, fd);
             break;
-        case 'N': // new_id N = sun
+        case TRACER_ARG_NEW_ID_DYNAMIC: // new_id N = sun
             // e.g. wl_registry.bind(name: uint, id: new_id)
             // s
             length = *p++;
@@ -178,61 +281,164 @@ analyze_protocol(struct tracer_connection *connection,
             // n
             new_id = *p++;
             if (new_id != 0) {
-                wl_map_reserve_new(objects, new_id);
                 struct tracer_interface **ptype = tracer_analyzer_lookup_type(analyzer, type_name);
-                struct tracer_interface *type = ptype == NULL ? NULL : *ptype;
-                wl_map_insert_at(objects, 0, new_id, type);
+                tracer_objects_insert(objects, new_id, ptype == NULL ? NULL : *ptype);
             }
-            tracer_log_cont("new_id %u[%s,%u]", new_id, type_name, name);
+            // "new_id %u[%s,%u]"
+            tracer_format_literal(&f, "new_id ");
+            tracer_format_uint(&f, new_id);
+            tracer_format_literal(&f, "[");
+            tracer_format_string(&f, type_name);
+            tracer_format_literal(&f, ",");
+            tracer_format_uint(&f, name);
+            tracer_format_literal(&f, "]");
             break;
         }
     }
 
-    tracer_log_cont(")");
+    tracer_format_literal(&f, ")");
+    tracer_format_flush(&f);
     tracer_log_end();
 
-  finish:
-    // does order mater ???
-    wl_connection_write(peer->wl_conn, buf, size);
-    wl_connection_consume(connection->wl_conn, size);
-
     return 0;
 }
 
 /**************************************************************************************************/
 
-static int
-analyze_handle_data(struct tracer_connection *connection, int len)
+// Keep track of the objects created by a message which is not shown, and pass its fds along, its
+// lengths already checked by tracer_plan_check()
+static void
+analyze_track(struct tracer_instance *instance, const char *buf,
+              struct tracer_message *message, struct analyze_fds *fds)
 {
-    struct tracer_instance *instance = connection->instance;
+    struct tracer_analyzer *analyzer = (struct tracer_analyzer *) instance->tracer->frontend_data;
+    const struct tracer_plan *plan = message->plan;
+    const uint32_t *p = (const uint32_t *) buf + 2;
+    struct tracer_interface **ptype;
+    char *type_name;
+    uint32_t length, new_id;
+
+    if (!(plan->flags & (TRACER_PLAN_FD | TRACER_PLAN_NEW_ID)))
+        return;
+
+    for (int i = 0; i < plan->arg_count; i++) {
+        switch (plan->args[i].kind) {
+        case TRACER_ARG_STRING:
+        case TRACER_ARG_ARRAY:
+            length = *p++;
+            p += div_roundup(length, sizeof *p);
+            break;
+        case TRACER_ARG_NEW_ID:
+            new_id = *p++;
+            if (new_id != 0)
+                tracer_objects_insert(&instance->objects, new_id, message->types[0]);
+            break;
+        case TRACER_ARG_NEW_ID_DYNAMIC:
+            length = *p++;
+            type_name = length != 0 ? (char *) p : NULL;
+            p += div_roundup(length, sizeof *p) + 1;
+            new_id = *p++;
+            if (new_id != 0) {
+                ptype = tracer_analyzer_lookup_type(analyzer, type_name);
+                tracer_objects_insert(&instance->objects, new_id, ptype == NULL ? NULL : *ptype);
+            }
+            break;
+        case TRACER_ARG_FD:
+            analyze_next_fd(fds);
+            break;
+        default:
+            p++;
+            break;
+        }
+    }
+}
+
+// The id of a destroyed object of the client is only free once the compositor acknowledges it
+// with wl_display.delete_id, the events sent in the meantime are still decoded. The objects of
+// the compositor are gone as soon as they are destroyed.
+static void
+analyze_lifetime(struct tracer_instance *instance, uint32_t id,
+                 const struct tracer_message *message, const char *buf)
+{
+    struct tracer_analyzer *analyzer = (struct tracer_analyzer *) instance->tracer->frontend_data;
 
-    uint32_t p[2];
-    wl_connection_copy(connection->wl_conn, p, sizeof p);
+    if (message->plan->flags & TRACER_PLAN_DESTRUCTOR) {
+        if (id < TRACER_SERVER_ID_START)
+            tracer_objects_destroy(&instance->objects, id);
+        else
+            tracer_objects_remove(&instance->objects, id);
+    }
+    else if (message == analyzer->delete_id) {
+        tracer_objects_remove(&instance->objects, ((const uint32_t *) buf)[2]);
+    }
+}
+
+// Log a message and keep track of the objects it creates and destroys
+static void
+analyze_message_fds(struct tracer_instance *instance, int side,
+                    const char *buf, uint32_t size, struct analyze_fds *fds)
+{
+    const uint32_t *p = (const uint32_t *) buf;
     uint32_t id = p[0];
     int opcode = p[1] & 0xffff;
-    int size = p[1] >> 16;
-    if (len < size)
-        return 0;
+    struct tracer_formatter f;
+
+    struct tracer_message *message = NULL;
+    struct tracer_interface *interface = tracer_objects_lookup(&instance->objects, id);
+    if (interface != NULL) {
+        if (side == TRACER_SERVER_SIDE)
+            message = opcode < interface->event_count ? interface->events[opcode] : NULL;
+        else
+            message = opcode < interface->method_count ? interface->methods[opcode] : NULL;
+    }
+
+    // lengths come from the wire, a message whose arguments do not fit is not decoded
+    int valid = message != NULL && tracer_plan_check(message->plan, buf, size) == 0;
+
+    if (instance->latency != NULL && valid)
+        tracer_latency_message(instance->tracer->latency, instance->latency, side, id, message, buf,
+                               instance->time);
+
+    // statistics only, nothing is printed per message
+    if (instance->stats != NULL) {
+        struct tracer_stats *stats = instance->tracer->stats;
+        if (!valid) {
+            stats->unknown++;
+            return;
+        }
+        tracer_stats_count(stats, instance->stats, interface, side, opcode, size,
+                           message->plan->fd_count);
+        analyze_track(instance, buf, message, fds);
+        analyze_lifetime(instance, id, message, buf);
+        return;
+    }
+
+    // filtered out before any formatting, invalid messages are always shown
+    if (valid && instance->filter_bits != NULL &&
+        !tracer_filter_shows(instance->tracer->filter, instance->filter_bits,
+                             interface, side, opcode)) {
+        analyze_track(instance, buf, message, fds);
+        analyze_lifetime(instance, id, message, buf);
+        return;
+    }
 
     tracer_log("%s Message %u opcode %u, size %u\n",
-               connection->side == TRACER_SERVER_SIDE ? "->" : "<-",
+               side == TRACER_SERVER_SIDE ? "->" : "<-",
                id, opcode, size);
-    {
-      // Log message bytes
-      char buf[4096];
-      wl_connection_copy(connection->wl_conn, buf, len);
-      for (int i = 0; i < 4*size; i++)
-        tracer_log_cont("%02x ", (unsigned char) buf[i]);
-      tracer_log_cont("\n");
-    }
+    // Log message bytes, "%02x " each
+    tracer_format_init(&f, instance);
+    tracer_format_hex(&f, buf, size);
+    tracer_format_literal(&f, "\n");
+    tracer_format_flush(&f);
 
-    struct tracer_message *message;
-    struct tracer_interface *interface = wl_map_lookup(&instance->map, id);
     if (interface != NULL) {
-        if (connection->side == TRACER_SERVER_SIDE)
-            message = interface->events[opcode];
-        else
-            message = interface->methods[opcode];
+        // the plan tells how long the message and its arguments must be
+        if (!valid) {
+            tracer_log("\x1b[31mInvalid message %s@%u opcode %u, size %u\x1b[0m",
+                       interface->name, id, opcode, size);
+            tracer_log_end();
+            return;
+        }
     }
     else {
        tracer_log("\x1b[31mUnknown object %u opcode %u, size %u\x1b[0m", id, opcode, size);
@@ -240,10 +446,103 @@ analyze_handle_data(struct tracer_connection *connection, int len)
        tracer_log_end();
     }
 
-    analyze_protocol(connection, size, &instance->map, interface, id, message);
+    analyze_protocol(instance, side, buf, &instance->objects, interface, id, message, fds);
+
+    if (message != NULL)
+        analyze_lifetime(instance, id, message, buf);
+}
 
-    if (interface != NULL && !strcmp(message->name, "destroy"))
-        wl_map_remove(&instance->map, id);
+// Return the number of fds used by the message
+int
+analyze_message(struct tracer_instance *instance, int side,
+                const char *data, uint32_t size, const int32_t *fds, int fd_count)
+{
+    struct analyze_fds message_fds = { NULL, NULL, fds, fd_count, 0 };
+
+    analyze_message_fds(instance, side, data, size, &message_fds);
+
+    return message_fds.index;
+}
+
+/**************************************************************************************************/
+
+// Log the objects an instance did not destroy, per interface, most frequent first
+void
+analyze_report_leaks(struct tracer_instance *instance)
+{
+    struct tracer_analyzer *analyzer = (struct tracer_analyzer *) instance->tracer->frontend_data;
+    struct tracer_objects *objects = &instance->objects;
+    struct tracer_interface *interface;
+    uint32_t *counts, total = 0, index, max;
+    int count, i, best;
+
+    for (count = 0; analyzer->interfaces[count] != NULL; count++)
+        ;
+    counts = calloc(count + 1, sizeof *counts);
+    if (counts == NULL)
+        return;
+
+    for (int side = 0; side < 2; side++) {
+        for (index = 0; index < objects->count[side]; index++) {
+            interface = objects->interfaces[side][index];
+            if (interface == NULL || interface == analyzer->display_interface ||
+                (objects->generations[side][index] & TRACER_OBJECTS_DESTROYED))
+                continue;
+            counts[interface->type_index]++;
+            total++;
+        }
+    }
+
+    if (total != 0) {
+        tracer_log("\x1b[33mInstance %d ends with %u objects alive:", instance->id, total);
+        for (;;) {
+            for (i = 0, best = -1, max = 0; i < count; i++) {
+                if (counts[i] > max) {
+                    max = counts[i];
+                    best = i;
+                }
+            }
+            if (best < 0)
+                break;
+            tracer_log_cont(" %u %s", max, analyzer->interfaces[best]->name);
+            counts[best] = 0;
+        }
+        tracer_log_cont("\x1b[0m");
+        tracer_log_end();
+    }
+
+    free(counts);
+}
+
+static void
+analyze_destroy(struct tracer_instance *instance)
+{
+    instance->time = tracer_monotonic_time();
+    analyze_report_leaks(instance);
+}
+
+/**************************************************************************************************/
+
+static int
+analyze_handle_data(struct tracer_connection *connection, int len)
+{
+    struct tracer_instance *instance = connection->instance;
+    struct tracer_connection *peer = connection->peer;
+    struct analyze_fds fds = { connection->wl_conn, peer->wl_conn, NULL, 0, 0 };
+    // the message size is a 16-bit field of the header
+    uint32_t buf[(1 << 16) / sizeof(uint32_t)];
+
+    wl_connection_copy(connection->wl_conn, buf, 2 * sizeof(uint32_t));
+    int size = buf[1] >> 16;
+    if (len < size)
+        return 0;
+
+    wl_connection_copy(connection->wl_conn, buf, size);
+    analyze_message_fds(instance, connection->side, (const char *) buf, size, &fds);
+
+    // forward the message, its fds were queued by analyze_next_fd()
+    wl_connection_write(peer->wl_conn, buf, size);
+    wl_connection_consume(connection->wl_conn, size);
 
     return size;
 }
@@ -252,5 +551,6 @@ analyze_handle_data(struct tracer_connection *connection, int len)
 
 struct tracer_frontend_interface tracer_frontend_analyze = {
     .init = analyze_init,
-    .data = analyze_handle_data
+    .data = analyze_handle_data,
+    .destroy = analyze_destroy
 };
@@ -32,6 +32,10 @@ extern "C"
 
 extern struct tracer_frontend_interface tracer_frontend_analyze;
 
+int analyze_message(struct tracer_instance *instance, int side,
+                    const char *data, uint32_t size, const int32_t *fds, int fd_count);
+void analyze_report_leaks(struct tracer_instance *instance);
+
 #ifdef __cplusplus
 }
 #endif
@@ -36,76 +36,103 @@ bin_init(struct tracer *tracer)
 
 /**************************************************************************************************/
 
+// Return the byte at offset of the data described by the ring buffer segments
+static inline unsigned char
+iov_byte(const struct iovec *iov, uint32_t offset)
+{
+    if (offset < iov[0].iov_len)
+        return ((unsigned char *) iov[0].iov_base)[offset];
+    else
+        return ((unsigned char *) iov[1].iov_base)[offset - iov[0].iov_len];
+}
+
+static uint32_t
+iov_uint32(const struct iovec *iov, uint32_t offset)
+{
+    uint32_t value;
+    unsigned char *p = (unsigned char *) &value;
+
+    for (size_t i = 0; i < sizeof value; i++)
+        p[i] = iov_byte(iov, offset + i);
+
+    return value;
+}
+
+/**************************************************************************************************/
+
 static int
 bin_handle_data(struct tracer_connection *connection, int rlen)
 {
-    // this handler process all the messages
+    // this handler process all the complete messages of the input buffer,
+    // a trailing partial message is kept in the ring buffer until the rest of it is received
 
     struct tracer_instance *instance = connection->instance;
     struct wl_connection *wl_conn = connection->wl_conn;
     struct tracer_connection *peer = connection->peer;
+    struct iovec iov[2];
+    int count;
 
-    int len = ring_buffer_size(&wl_conn->in);
-    if (len == 0)
+    uint32_t len = ring_buffer_size(&wl_conn->in);
+    if (len < 8)
         return 0;
 
-    char buf[4096];
-    // Fixme: len > 4096
-    wl_connection_copy(wl_conn, buf, len);
-
-    // dump bytes
-    // tracer_log("%s Data dumped: %d bytes:\n",
-    //            connection->side == TRACER_SERVER_SIDE ? "=>" : "<=", len);
-    // for (int i = 0; i < len; i++)
-    //     tracer_log_cont("%02x ", (unsigned char) buf[i]);
-    // tracer_log_cont("\n");
-
-    {
-        // buffer can contain more than one message
-        size_t message_count = 0;
-        const char *pm = buf;
-        int size;
-        // header size = 8
-        for (int remain = len; remain >= 8; remain -= size, pm += size) {
-            message_count += 1;
-            uint32_t *header = (uint32_t *)pm;
-            uint32_t id = header[0];
-            int opcode = header[1] & 0xffff;
-            size = header[1] >> 16;
-            if (len < size)
-                return 0;
-            tracer_log("\x1b[31m%s \x1b[32mMessage %u \x1b[35mopcode %u\x1b[0m, size %u\n",
-                       connection->side == TRACER_SERVER_SIDE ? "=>" : "<=",
-                       id, opcode, size);
-            for (int i = 0; i < size; i++)
-                tracer_log_cont("%02x ", (unsigned char) pm[i]);
-            tracer_log_cont("\n");
+    // messages are parsed in place
+    ring_buffer_get_iov(&wl_conn->in, iov, &count);
+    if (count == 1)
+        iov[1].iov_len = 0;
+
+    size_t message_count = 0;
+    uint32_t offset, size;
+    // header size = 8
+    for (offset = 0; len - offset >= 8; offset += size) {
+        uint32_t id = iov_uint32(iov, offset);
+        uint32_t word = iov_uint32(iov, offset + 4);
+        int opcode = word & 0xffff;
+        size = word >> 16;
+        if (size < 8) {
+            // not a Wayland stream, forward everything as is
+            tracer_log("\x1b[31mInvalid message size %u, forwarding %u bytes\x1b[0m",
+                       size, len - offset);
+            tracer_log_end();
+            offset = len;
+            break;
         }
-        tracer_log("      \x1b[36m%u messages\x1b[0m\n", message_count);
+        if (len - offset < size)
+            break;
+        message_count += 1;
+        tracer_log("\x1b[31m%s \x1b[32mMessage %u \x1b[35mopcode %u\x1b[0m, size %u\n",
+                   connection->side == TRACER_SERVER_SIDE ? "=>" : "<=",
+                   id, opcode, size);
+        for (uint32_t i = 0; i < size; i++)
+            tracer_log_cont("%02x ", iov_byte(iov, offset + i));
+        tracer_log_cont("\n");
     }
 
-    wl_connection_consume(wl_conn, len);
-    // forward message
-    wl_connection_write(peer->wl_conn, buf, len);
+    if (offset == 0)
+        return 0;
 
-    // handle fd
-    int fdlen = ring_buffer_size(&wl_conn->fds_in);
-    ring_buffer_copy(&wl_conn->fds_in, buf, fdlen);
-    fdlen /= sizeof(int32_t);
-    if (fdlen != 0)
+    tracer_log("      \x1b[36m%u messages\x1b[0m\n", message_count);
+
+    // log fds, they are forwarded with the first complete messages
+    int fdlen = ring_buffer_size(&wl_conn->fds_in) / sizeof(int32_t);
+    if (fdlen != 0) {
+        ring_buffer_get_iov(&wl_conn->fds_in, iov, &count);
         tracer_log_cont(">>> %d Fds in control data:", fdlen);
-    for (int i = 0; i < fdlen; i++) {
-        int fd = ((int *) buf)[i];
-        tracer_log_cont("%d ", fd);
-        wl_connection_put_fd(peer->wl_conn, fd);
     }
+    for (int i = 0; i < fdlen; i++)
+        tracer_log_cont("%d ", (int32_t) iov_uint32(iov, i * sizeof(int32_t)));
     // Fixme: \n
     if (fdlen != 0)
       tracer_log_cont("\n");
     tracer_log_end();
-    wl_conn->fds_in.tail += fdlen * sizeof(int32_t);
 
-    return len; // no more messages to process
+    // forward messages and fds straight from the ring buffer
+    if (wl_connection_forward(wl_conn, peer->wl_conn, offset) < 0) {
+        tracer_log("\x1b[31mFailed to forward %u bytes: %m\x1b[0m", offset);
+        tracer_log_end();
+    }
+
+    return offset;
 }
 
 /**************************************************************************************************/
@@ -0,0 +1,129 @@
+// -*- mode: C; c-basic-offset: 4 -*-
+
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "wayland-private.h"
+#include "tracer.h"
+#include "tracer-clock.h"
+#include "tracer-record.h"
+#include "tracer-writer.h"
+#include "frontend-record.h"
+
+/**************************************************************************************************/
+
+static int
+record_init(struct tracer *tracer)
+{
+    struct tracer_record_file_header header;
+
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, TRACER_RECORD_MAGIC, sizeof TRACER_RECORD_MAGIC);
+    header.version = TRACER_RECORD_VERSION;
+    header.mode = tracer->options->mode;
+    header.realtime_offset = tracer->time_offset;
+    // the flight recorder writes its own header when dumped, the queue is decoded live
+    if (tracer->recorder == NULL && tracer->queue == NULL)
+        tracer_writer_write(tracer->writer, &header, sizeof header);
+
+    return 0;
+}
+
+/**************************************************************************************************/
+
+static void
+record_write_ring(struct tracer_instance *instance, struct wl_ring_buffer *b, uint32_t size)
+{
+    struct iovec iov[2];
+    int count;
+
+    ring_buffer_get_iov(b, iov, &count);
+    if (iov[0].iov_len >= size) {
+        tracer_output_write(instance, iov[0].iov_base, size);
+    }
+    else {
+        tracer_output_write(instance, iov[0].iov_base, iov[0].iov_len);
+        tracer_output_write(instance, iov[1].iov_base, size - iov[0].iov_len);
+    }
+}
+
+static int
+record_handle_data(struct tracer_connection *connection, int len)
+{
+    // this handler writes all the complete messages as a single record, without any formatting
+
+    struct tracer_instance *instance = connection->instance;
+    struct wl_connection *wl_conn = connection->wl_conn;
+    struct tracer_record_header header;
+
+    uint32_t size = wl_connection_complete_size(wl_conn);
+    if (size == 0)
+        return 0;
+
+    uint32_t fds_size = ring_buffer_size(&wl_conn->fds_in);
+
+    header.size = sizeof header + size + fds_size;
+    header.instance = instance->id;
+    header.time = instance->time;
+    header.side = connection->side;
+    header.fd_count = fds_size / sizeof(int32_t);
+    header.data_size = size;
+
+    tracer_output_begin(instance, header.time, header.size);
+    tracer_output_write(instance, &header, sizeof header);
+    record_write_ring(instance, &wl_conn->in, size);
+    if (fds_size > 0)
+        record_write_ring(instance, &wl_conn->fds_in, fds_size);
+    tracer_output_end(instance);
+
+    if (wl_connection_forward(wl_conn, connection->peer->wl_conn, size) < 0)
+        fprintf(stderr, "Failed to forward %u bytes: %m\n", size);
+
+    return size;
+}
+
+// An empty record tells the decoder the instance is gone
+static void
+record_destroy(struct tracer_instance *instance)
+{
+    struct tracer_record_header header;
+
+    memset(&header, 0, sizeof header);
+    header.size = sizeof header;
+    header.instance = instance->id;
+    header.time = tracer_monotonic_time();
+
+    tracer_output_begin(instance, header.time, header.size);
+    tracer_output_write(instance, &header, sizeof header);
+    tracer_output_end(instance);
+}
+
+/**************************************************************************************************/
+
+struct tracer_frontend_interface tracer_frontend_record = {
+    .init = record_init,
+    .data = record_handle_data,
+    .destroy = record_destroy
+};
@@ -28,6 +28,8 @@
 #include <errno.h>
 #include <ctype.h>
 #include <expat.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "tracer-analyzer.h"
 #include "wayland-util.h"
@@ -303,11 +305,10 @@ tracer_analyzer_create(void)
     return analyzer;
 }
 
-int
-tracer_analyzer_add_protocol(struct tracer_analyzer *analyzer, const char *filename)
+// Parse a protocol file into protocol, ctx is the state of the calling thread
+static int
+parse_protocol(struct parse_context *ctx, struct tracer_protocol *protocol, const char *filename)
 {
-    struct tracer_protocol protocol;
-    struct parse_context *ctx = analyzer->ctx;
     void *buf;
     int len;
     FILE *fp;
@@ -318,15 +319,16 @@ tracer_analyzer_add_protocol(struct tracer_analyzer *analyzer, const char *filen
         return -1;
     }
 
-    wl_list_init(&protocol.interface_list);
+    wl_list_init(&protocol->interface_list);
     memset(ctx, 0, sizeof *ctx);
-    ctx->protocol = &protocol;
+    ctx->protocol = protocol;
 
     ctx->loc.filename = filename;
     ctx->parser = XML_ParserCreate(NULL);
     XML_SetUserData(ctx->parser, ctx);
     if (ctx->parser == NULL) {
         fprintf(stderr, "failed to create parser\n");
+        fclose(fp);
         return -1;
     }
 
@@ -347,23 +349,187 @@ tracer_analyzer_add_protocol(struct tracer_analyzer *analyzer, const char *filen
     fclose(fp);
     XML_ParserFree(ctx->parser);
 
+    return 0;
+}
+
+int
+tracer_analyzer_add_protocol(struct tracer_analyzer *analyzer, const char *filename)
+{
+    struct tracer_protocol protocol;
+
+    if (parse_protocol(analyzer->ctx, &protocol, filename) != 0)
+        return -1;
+
     wl_list_insert_list(analyzer->interface_list.prev, &protocol.interface_list);
 
     return 0;
 }
 
+/**************************************************************************************************/
+
+struct parse_job
+{
+    const char *filename;
+    struct tracer_protocol protocol;
+    int rc;
+};
+
+struct parse_pool
+{
+    struct parse_job *jobs;
+    int count;
+    int next;
+    pthread_mutex_t lock;
+};
+
+// Parse the next pending file until there is none left
+static void *
+parse_worker(void *data)
+{
+    struct parse_pool *pool = data;
+    struct parse_context *ctx;
+    struct parse_job *job;
+    int index;
+
+    ctx = xmalloc(sizeof *ctx);
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        index = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        if (index >= pool->count)
+            break;
+
+        job = &pool->jobs[index];
+        job->rc = parse_protocol(ctx, &job->protocol, job->filename);
+    }
+
+    free(ctx);
+
+    return NULL;
+}
+
+// Parse the files on up to one thread per CPU, the interfaces are added in the order of the files
+// whatever the order the parsing completes in
+int
+tracer_analyzer_add_protocols(struct tracer_analyzer *analyzer, const char **files, int count)
+{
+    struct parse_pool pool;
+    pthread_t threads[TRACER_ANALYZER_MAX_THREADS];
+    long cpus;
+    int i, thread_count, started, rc = 0;
+
+    if (count == 0)
+        return 0;
+
+    pool.jobs = calloc(count, sizeof *pool.jobs);
+    if (pool.jobs == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    pool.count = count;
+    pool.next = 0;
+    pthread_mutex_init(&pool.lock, NULL);
+
+    for (i = 0; i < count; i++)
+        pool.jobs[i].filename = files[i];
+
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    thread_count = cpus < 1 ? 1 : cpus;
+    if (thread_count > count)
+        thread_count = count;
+    if (thread_count > TRACER_ANALYZER_MAX_THREADS)
+        thread_count = TRACER_ANALYZER_MAX_THREADS;
+
+    // the calling thread is one of the workers
+    for (started = 0; started < thread_count - 1; started++) {
+        if (pthread_create(&threads[started], NULL, parse_worker, &pool) != 0)
+            break;
+    }
+    parse_worker(&pool);
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&pool.lock);
+
+    for (i = 0; i < count; i++) {
+        if (pool.jobs[i].rc != 0) {
+            fprintf(stderr, "failed to add file %s\n", files[i]);
+            rc = -1;
+            break;
+        }
+        wl_list_insert_list(analyzer->interface_list.prev, &pool.jobs[i].protocol.interface_list);
+    }
+
+    free(pool.jobs);
+
+    return rc;
+}
+
+/**************************************************************************************************/
+
+// FNV-1a
+static uint32_t
+hash_type_name(const char *name)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*name != '\0') {
+        hash ^= (unsigned char) *name++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+// Index the interfaces by name, the table is kept at most half full so probe sequences stay short
+static int
+build_type_table(struct tracer_analyzer *analyzer, int count)
+{
+    uint32_t size, mask, slot, index;
+    uint32_t *table;
+    int i;
+
+    for (size = 16; size < 2 * (uint32_t) count; size *= 2)
+        ;
+    mask = size - 1;
+
+    table = calloc(size, sizeof *table);
+    if (table == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        const char *name = analyzer->interfaces[i]->name;
+        for (slot = hash_type_name(name) & mask; (index = table[slot]) != 0; slot = (slot + 1) & mask) {
+            // on duplicate names the first interface wins, as with a linear search
+            if (strcmp(analyzer->interfaces[index - 1]->name, name) == 0)
+                break;
+        }
+        if (index == 0)
+            table[slot] = i + 1;
+    }
+
+    analyzer->type_table = table;
+    analyzer->type_table_mask = mask;
+
+    return 0;
+}
+
 struct tracer_interface **
 tracer_analyzer_lookup_type(struct tracer_analyzer *analyzer, char *type_name)
 {
-    struct tracer_interface **types = analyzer->interfaces;
+    uint32_t slot, index;
 
     if (type_name == NULL)
         return NULL;
 
-    while (*types != NULL) {
-        if (strcmp((*types)->name, type_name) == 0)
-            return types;
-        types++;
+    slot = hash_type_name(type_name) & analyzer->type_table_mask;
+    while ((index = analyzer->type_table[slot]) != 0) {
+        if (strcmp(analyzer->interfaces[index - 1]->name, type_name) == 0)
+            return &analyzer->interfaces[index - 1];
+        slot = (slot + 1) & analyzer->type_table_mask;
     }
 
     return NULL;
@@ -377,7 +543,7 @@ generate_signature(struct tracer_message *message)
     struct tracer_arg *arg;
 
     length = wl_list_length(&message->arg_list);
-    signature = malloc(length);
+    signature = malloc(length + 1);
     if (signature == NULL) {
         errno = ENOMEM;
         return -1;
@@ -418,6 +584,165 @@ generate_signature(struct tracer_message *message)
         i++;
     }
     signature[length] = '\0';
+
+    return 0;
+}
+
+// Compile the signature of a message into its decode plan, also used when it is loaded from the
+// protocol cache
+int
+tracer_analyzer_compile_plan(struct tracer_message *message)
+{
+    struct tracer_plan *plan;
+    size_t length = strlen(message->signature);
+    uint32_t slot = 2, fixed = 1;
+    size_t i;
+
+    plan = malloc(sizeof *plan + length * sizeof plan->args[0]);
+    if (plan == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    plan->arg_count = length;
+    plan->fixed_count = 0;
+    plan->flags = message->destructor ? TRACER_PLAN_DESTRUCTOR : 0;
+    plan->signature_length = length;
+    plan->fd_count = 0;
+    plan->padding = 0;
+
+    for (i = 0; i < length; i++) {
+        struct tracer_plan_arg *arg = &plan->args[i];
+        uint32_t words = 1;
+
+        switch (message->signature[i]) {
+        case 'u':
+            arg->kind = TRACER_ARG_UINT;
+            break;
+        case 'i':
+            arg->kind = TRACER_ARG_INT;
+            break;
+        case 'f':
+            arg->kind = TRACER_ARG_FIXED;
+            break;
+        case 's':
+            arg->kind = TRACER_ARG_STRING;
+            break;
+        case 'o':
+            arg->kind = TRACER_ARG_OBJECT;
+            break;
+        case 'n':
+            arg->kind = TRACER_ARG_NEW_ID;
+            plan->flags |= TRACER_PLAN_NEW_ID;
+            break;
+        case 'N':
+            // length of the empty interface name, version and new_id
+            arg->kind = TRACER_ARG_NEW_ID_DYNAMIC;
+            plan->flags |= TRACER_PLAN_NEW_ID;
+            words = 3;
+            break;
+        case 'a':
+            arg->kind = TRACER_ARG_ARRAY;
+            break;
+        case 'h':
+            // fds are not on the wire
+            arg->kind = TRACER_ARG_FD;
+            plan->flags |= TRACER_PLAN_FD;
+            plan->fd_count++;
+            words = 0;
+            break;
+        default:
+            free(plan);
+            errno = EINVAL;
+            return -1;
+        }
+
+        arg->padding = 0;
+        arg->slot = fixed ? slot : 0;
+        if (fixed)
+            plan->fixed_count++;
+        // the size of a string or an array is only known from the message
+        if (arg->kind == TRACER_ARG_STRING || arg->kind == TRACER_ARG_ARRAY ||
+            arg->kind == TRACER_ARG_NEW_ID_DYNAMIC) {
+            fixed = 0;
+            plan->flags |= TRACER_PLAN_VARIABLE;
+        }
+        slot += words;
+    }
+    plan->min_size = slot * sizeof(uint32_t);
+
+    message->plan = plan;
+
+    return 0;
+}
+
+// Check that a message of size bytes holds all the arguments of its plan: every string, array
+// and interface name fits in what is left of the message, and strings end with their NUL. The
+// decoders can then walk the arguments without bounds checks. Returns 0 if the message is valid.
+int
+tracer_plan_check(const struct tracer_plan *plan, const char *buf, uint32_t size)
+{
+    const uint32_t *p = (const uint32_t *) buf + 2;
+    const uint32_t *end = (const uint32_t *) buf + size / sizeof *p;
+    uint32_t length;
+
+    if (size < plan->min_size)
+        return -1;
+    // the leading arguments are within min_size
+    if (!(plan->flags & TRACER_PLAN_VARIABLE))
+        return 0;
+
+    for (int i = 0; i < plan->arg_count; i++) {
+        switch (plan->args[i].kind) {
+        case TRACER_ARG_STRING:
+        case TRACER_ARG_ARRAY:
+        case TRACER_ARG_NEW_ID_DYNAMIC:
+            if (p >= end)
+                return -1;
+            length = *p++;
+            if (length > (uint32_t) (end - p) * sizeof *p)
+                return -1;
+            if (plan->args[i].kind != TRACER_ARG_ARRAY && length != 0 &&
+                ((const char *) p)[length - 1] != '\0')
+                return -1;
+            p += (length + sizeof *p - 1) / sizeof *p;
+            // version and new_id
+            if (plan->args[i].kind == TRACER_ARG_NEW_ID_DYNAMIC) {
+                if (end - p < 2)
+                    return -1;
+                p += 2;
+            }
+            break;
+        case TRACER_ARG_FD:
+            break;
+        default:
+            if (p >= end)
+                return -1;
+            p++;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+// Index the interfaces array, also used when it is loaded from the protocol cache
+int
+tracer_analyzer_index(struct tracer_analyzer *analyzer, int count)
+{
+    struct tracer_interface **display_type;
+
+    if (build_type_table(analyzer, count) < 0)
+        return -1;
+
+    display_type = tracer_analyzer_lookup_type(analyzer, "wl_display");
+    if (display_type == NULL) {
+        fprintf(stderr, "You should at least have wl_display!\n");
+        return -1;
+    }
+    analyzer->display_interface = *display_type;
+
+    return 0;
 }
 
 int
@@ -426,7 +751,6 @@ tracer_analyzer_finalize(struct tracer_analyzer *analyzer)
     int count, message_count, i, j;
     struct tracer_interface *interface;
     struct tracer_interface **interfaces;
-    struct tracer_interface **display_type;
     struct tracer_message **messages;
     struct tracer_message *message;
 
@@ -441,9 +765,13 @@ tracer_analyzer_finalize(struct tracer_analyzer *analyzer)
     i = 0;
     wl_list_for_each(interface, &analyzer->interface_list, link) {
         interfaces[i] = interface;
+        interface->type_index = i;
         i++;
     }
 
+    if (tracer_analyzer_index(analyzer, count) < 0)
+        return -1;
+
     for (i = 0; i < count; i++) {
         interface = interfaces[i];
         message_count = wl_list_length(&interface->request_list);
@@ -462,7 +790,7 @@ tracer_analyzer_finalize(struct tracer_analyzer *analyzer)
                 fprintf(stderr, "interface %s not found\n", message->new_interface_name);
                 return -1;
             }
-            if (generate_signature(message) < 0)
+            if (generate_signature(message) < 0 || tracer_analyzer_compile_plan(message) < 0)
                 return -1;
             j++;
         }
@@ -483,19 +811,12 @@ tracer_analyzer_finalize(struct tracer_analyzer *analyzer)
                 fprintf(stderr, "interface %s not found\n", message->new_interface_name);
                 return -1;
             }
-            if (generate_signature(message) < 0)
+            if (generate_signature(message) < 0 || tracer_analyzer_compile_plan(message) < 0)
                 return -1;
             j++;
         }
     }
 
-    display_type = tracer_analyzer_lookup_type(analyzer, "wl_display");
-    if (display_type == NULL) {
-        fprintf(stderr, "You should at least have wl_display!\n");
-        return -1;
-    }
-    analyzer->display_interface = *display_type;
-
     free(analyzer->ctx);
 
     return 0;
@@ -23,6 +23,8 @@
 #ifndef TRACER_ANALYZER_H
 #define TRACER_ANALYZER_H
 
+#include <stdint.h>
+
 #include "wayland-util.h"
 
 #ifdef __cplusplus
@@ -36,8 +38,49 @@ struct location
     int line_number;
 };
 
+// Maximum number of threads parsing protocol files
+#define TRACER_ANALYZER_MAX_THREADS 16
+
 struct tracer_message;
 
+// Argument kinds of a decode plan
+#define TRACER_ARG_UINT 0
+#define TRACER_ARG_INT 1
+#define TRACER_ARG_FIXED 2
+#define TRACER_ARG_STRING 3
+#define TRACER_ARG_OBJECT 4
+#define TRACER_ARG_NEW_ID 5         // new_id of a known interface
+#define TRACER_ARG_NEW_ID_DYNAMIC 6 // interface name, version and new_id, as in wl_registry.bind
+#define TRACER_ARG_ARRAY 7
+#define TRACER_ARG_FD 8
+
+// Decode plan flags
+#define TRACER_PLAN_FD (1 << 0)
+#define TRACER_PLAN_NEW_ID (1 << 1)
+#define TRACER_PLAN_DESTRUCTOR (1 << 2)
+#define TRACER_PLAN_VARIABLE (1 << 3) // has a string, an array or a dynamic new_id
+
+struct tracer_plan_arg
+{
+    uint8_t kind;
+    uint8_t padding;
+    uint16_t slot;              // word index in the message, for the leading arguments only
+};
+
+// A message compiled for decoding: the arguments up to the first string, array or dynamic new_id
+// are at a fixed offset in the message, the following ones are read in sequence
+struct tracer_plan
+{
+    uint16_t arg_count;
+    uint16_t fixed_count;       // arguments with a valid slot
+    uint16_t flags;
+    uint16_t signature_length;
+    uint16_t fd_count;
+    uint16_t padding;
+    uint32_t min_size;          // size of the message with empty strings and arrays
+    struct tracer_plan_arg args[];
+};
+
 struct tracer_interface
 {
     struct location loc;
@@ -63,6 +106,7 @@ struct tracer_message
     char *new_interface_name;
     struct tracer_interface **types;
     char *signature;
+    struct tracer_plan *plan;
 };
 
 struct parse_context;
@@ -70,7 +114,14 @@ struct parse_context;
 struct tracer_analyzer
 {
     struct tracer_interface **interfaces;
+    // open addressing hash table of interface names, built by tracer_analyzer_finalize()
+    //   slots hold an index in interfaces plus one, 0 for an empty slot
+    uint32_t *type_table;
+    uint32_t type_table_mask;
     struct tracer_interface *display_interface;
+    // wl_display.delete_id, which frees the ids of the client, set by the analyze frontend, NULL
+    // if the protocol lacks it
+    struct tracer_message *delete_id;
     struct parse_context *ctx;
     struct wl_list interface_list;
 };
@@ -79,8 +130,15 @@ struct tracer_analyzer *tracer_analyzer_create(void);
 
 int tracer_analyzer_add_protocol(struct tracer_analyzer *analyzer, const char *filename);
 
+int tracer_analyzer_add_protocols(struct tracer_analyzer *analyzer, const char **files, int count);
+
 struct tracer_interface **tracer_analyzer_lookup_type(struct tracer_analyzer *analyzer, char *type_name);
 
+int tracer_analyzer_compile_plan(struct tracer_message *message);
+int tracer_plan_check(const struct tracer_plan *plan, const char *buf, uint32_t size);
+
+int tracer_analyzer_index(struct tracer_analyzer *analyzer, int count);
+
 int tracer_analyzer_finalize(struct tracer_analyzer *analyzer);
 
 #ifdef __cplusplus
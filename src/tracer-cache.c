@@ -0,0 +1,499 @@
+// -*- mode: C; c-basic-offset: 4 -*-
+
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "wayland-util.h"
+#include "tracer-analyzer.h"
+#include "tracer-cache.h"
+
+/**************************************************************************************************/
+
+// FNV-1a
+static uint64_t
+cache_hash(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+
+    while (size-- > 0) {
+        hash ^= *p++;
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+#define CACHE_HASH_INIT 14695981039346656037ull
+
+static int
+cache_get_key(const char *file, struct tracer_cache_file *key)
+{
+    char buf[65536];
+    struct stat st;
+    ssize_t len;
+    int fd;
+
+    fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    key->mtime_sec = st.st_mtim.tv_sec;
+    key->mtime_nsec = st.st_mtim.tv_nsec;
+    key->size = st.st_size;
+    key->hash = CACHE_HASH_INIT;
+    key->path = 0;
+    key->padding = 0;
+
+    while ((len = read(fd, buf, sizeof buf)) != 0) {
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            close(fd);
+            return -1;
+        }
+        key->hash = cache_hash(key->hash, buf, len);
+    }
+
+    close(fd);
+
+    return 0;
+}
+
+// Resolve the paths of the protocol files and compute their keys
+static int
+cache_get_keys(const char **files, int count, char **paths, struct tracer_cache_file *keys)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        paths[i] = realpath(files[i], NULL);
+        if (paths[i] == NULL || cache_get_key(paths[i], &keys[i]) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static void
+cache_free_paths(char **paths, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+        free(paths[i]);
+    free(paths);
+}
+
+// The cache file is named after the list of protocol files
+static int
+cache_get_path(char **paths, int count, char *path, size_t size, int create)
+{
+    const char *base, *home;
+    uint64_t hash = CACHE_HASH_INIT;
+    int i, len;
+
+    base = getenv("XDG_CACHE_HOME");
+    if (base != NULL && base[0] != '\0') {
+        len = snprintf(path, size, "%s", base);
+    }
+    else {
+        home = getenv("HOME");
+        if (home == NULL || home[0] == '\0')
+            return -1;
+        len = snprintf(path, size, "%s/.cache", home);
+    }
+    if (len < 0 || (size_t) len >= size)
+        return -1;
+    if (create && mkdir(path, 0700) < 0 && errno != EEXIST)
+        return -1;
+
+    len = snprintf(path + len, size - len, "/wayland-tracer") + len;
+    if ((size_t) len >= size)
+        return -1;
+    if (create && mkdir(path, 0700) < 0 && errno != EEXIST)
+        return -1;
+
+    for (i = 0; i < count; i++)
+        hash = cache_hash(hash, paths[i], strlen(paths[i]) + 1);
+
+    len = snprintf(path + len, size - len, "/protocols-%016llx", (unsigned long long) hash) + len;
+    if ((size_t) len >= size)
+        return -1;
+
+    return 0;
+}
+
+/**************************************************************************************************/
+
+static int
+cache_check_string(const struct tracer_cache_header *header, uint32_t offset)
+{
+    return offset < header->strings_size;
+}
+
+// Build the analyzer tables on top of a mapped cache file
+static int
+cache_map(struct tracer_analyzer *analyzer, const char *map, size_t size,
+          char **paths, const struct tracer_cache_file *keys, int count)
+{
+    const struct tracer_cache_header *header = (const struct tracer_cache_header *) map;
+    const struct tracer_cache_file *files;
+    const struct tracer_cache_interface *cache_interfaces;
+    const struct tracer_cache_message *cache_messages;
+    struct tracer_interface **interfaces;
+    struct tracer_interface *interface_data;
+    struct tracer_message **message_list;
+    struct tracer_message *message_data;
+    const char *strings;
+    size_t offset;
+    uint32_t i;
+
+    if (size < sizeof *header ||
+        memcmp(header->magic, TRACER_CACHE_MAGIC, sizeof TRACER_CACHE_MAGIC) != 0 ||
+        header->version != TRACER_CACHE_VERSION ||
+        header->file_count != (uint32_t) count)
+        return -1;
+
+    offset = sizeof *header;
+    files = (const struct tracer_cache_file *) (map + offset);
+    offset += (size_t) header->file_count * sizeof *files;
+    cache_interfaces = (const struct tracer_cache_interface *) (map + offset);
+    offset += (size_t) header->interface_count * sizeof *cache_interfaces;
+    cache_messages = (const struct tracer_cache_message *) (map + offset);
+    offset += (size_t) header->message_count * sizeof *cache_messages;
+    strings = map + offset;
+    offset += header->strings_size;
+
+    if (offset > size || header->strings_size == 0 || strings[header->strings_size - 1] != '\0')
+        return -1;
+
+    // stale cache
+    for (i = 0; i < header->file_count; i++) {
+        if (!cache_check_string(header, files[i].path) ||
+            strcmp(strings + files[i].path, paths[i]) != 0 ||
+            files[i].mtime_sec != keys[i].mtime_sec ||
+            files[i].mtime_nsec != keys[i].mtime_nsec ||
+            files[i].size != keys[i].size ||
+            files[i].hash != keys[i].hash)
+            return -1;
+    }
+
+    for (i = 0; i < header->interface_count; i++) {
+        const struct tracer_cache_interface *ci = &cache_interfaces[i];
+        if (!cache_check_string(header, ci->name) ||
+            (uint64_t) ci->first_message + ci->method_count + ci->event_count > header->message_count)
+            return -1;
+    }
+
+    for (i = 0; i < header->message_count; i++) {
+        const struct tracer_cache_message *cm = &cache_messages[i];
+        if (!cache_check_string(header, cm->name) ||
+            !cache_check_string(header, cm->signature) ||
+            !cache_check_string(header, cm->new_interface_name) ||
+            cm->type_index >= (int32_t) header->interface_count)
+            return -1;
+    }
+
+    interfaces = calloc(header->interface_count + 1, sizeof *interfaces);
+    interface_data = calloc(header->interface_count, sizeof *interface_data);
+    message_list = calloc(header->message_count, sizeof *message_list);
+    message_data = calloc(header->message_count, sizeof *message_data);
+    if (interfaces == NULL || interface_data == NULL || message_list == NULL || message_data == NULL)
+        goto err_alloc;
+
+    for (i = 0; i < header->message_count; i++) {
+        const struct tracer_cache_message *cm = &cache_messages[i];
+        struct tracer_message *message = &message_data[i];
+
+        message->name = (char *) strings + cm->name;
+        message->signature = (char *) strings + cm->signature;
+        if (cm->new_interface_name != 0)
+            message->new_interface_name = (char *) strings + cm->new_interface_name;
+        if (cm->type_index >= 0)
+            message->types = &interfaces[cm->type_index];
+        message->arg_count = cm->arg_count;
+        message->new_id_count = strpbrk(message->signature, "nN") != NULL;
+        message->destructor = cm->destructor;
+        wl_list_init(&message->arg_list);
+        wl_list_init(&message->link);
+        message_list[i] = message;
+        if (tracer_analyzer_compile_plan(message) < 0)
+            goto err_alloc;
+    }
+
+    for (i = 0; i < header->interface_count; i++) {
+        const struct tracer_cache_interface *ci = &cache_interfaces[i];
+        struct tracer_interface *interface = &interface_data[i];
+
+        interface->name = (char *) strings + ci->name;
+        interface->type_index = i;
+        wl_list_init(&interface->request_list);
+        wl_list_init(&interface->event_list);
+        wl_list_init(&interface->link);
+        interface->method_count = ci->method_count;
+        interface->methods = message_list + ci->first_message;
+        interface->event_count = ci->event_count;
+        interface->events = message_list + ci->first_message + ci->method_count;
+        interfaces[i] = interface;
+    }
+
+    analyzer->interfaces = interfaces;
+    if (tracer_analyzer_index(analyzer, header->interface_count) < 0) {
+        analyzer->interfaces = NULL;
+        goto err_alloc;
+    }
+
+    free(analyzer->ctx);
+    analyzer->ctx = NULL;
+
+    return 0;
+
+  err_alloc:
+    if (message_data != NULL) {
+        for (i = 0; i < header->message_count; i++)
+            free(message_data[i].plan);
+    }
+    free(interfaces);
+    free(interface_data);
+    free(message_list);
+    free(message_data);
+    return -1;
+}
+
+// Load the tables of the protocol files from the cache, fails if it is missing or stale
+int
+tracer_cache_load(struct tracer_analyzer *analyzer, const char **files, int count)
+{
+    struct tracer_cache_file *keys;
+    char path[4096];
+    struct stat st;
+    char **paths;
+    void *map;
+    int fd, rc = -1;
+
+    paths = calloc(count, sizeof *paths);
+    keys = calloc(count, sizeof *keys);
+    if (paths == NULL || keys == NULL)
+        goto out;
+
+    if (cache_get_keys(files, count, paths, keys) < 0 ||
+        cache_get_path(paths, count, path, sizeof path, 0) < 0)
+        goto out;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        goto out;
+
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        goto out;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        goto out;
+
+    // the tables point to the mapping, it is kept as long as the process
+    rc = cache_map(analyzer, map, st.st_size, paths, keys, count);
+    if (rc < 0)
+        munmap(map, st.st_size);
+
+  out:
+    if (paths != NULL)
+        cache_free_paths(paths, count);
+    free(keys);
+    return rc;
+}
+
+/**************************************************************************************************/
+
+struct cache_strings
+{
+    char *data;
+    size_t size, capacity;
+};
+
+static uint32_t
+cache_add_string(struct cache_strings *strings, const char *s)
+{
+    size_t len;
+    uint32_t offset;
+    char *data;
+
+    if (s == NULL)
+        return 0;
+
+    len = strlen(s) + 1;
+    if (strings->size + len > strings->capacity) {
+        size_t capacity = strings->capacity * 2;
+        while (strings->size + len > capacity)
+            capacity *= 2;
+        data = realloc(strings->data, capacity);
+        if (data == NULL) {
+            fprintf(stderr, "Failed to build protocol cache: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        strings->data = data;
+        strings->capacity = capacity;
+    }
+
+    offset = strings->size;
+    memcpy(strings->data + offset, s, len);
+    strings->size += len;
+
+    return offset;
+}
+
+static void
+cache_add_message(struct cache_strings *strings, struct tracer_analyzer *analyzer,
+                  struct tracer_message *message, struct tracer_cache_message *cm)
+{
+    cm->name = cache_add_string(strings, message->name);
+    cm->signature = cache_add_string(strings, message->signature);
+    cm->new_interface_name = cache_add_string(strings, message->new_interface_name);
+    cm->type_index = message->types != NULL ? message->types - analyzer->interfaces : -1;
+    cm->arg_count = message->arg_count;
+    cm->destructor = message->destructor;
+}
+
+// Write the tables of a finalized analyzer to the cache, errors are not fatal
+int
+tracer_cache_save(struct tracer_analyzer *analyzer, const char **files, int count)
+{
+    struct tracer_cache_header header;
+    struct tracer_cache_file *keys = NULL;
+    struct tracer_cache_interface *cache_interfaces = NULL;
+    struct tracer_cache_message *cache_messages = NULL;
+    struct cache_strings strings = { NULL, 0, 0 };
+    struct tracer_interface *interface;
+    char path[4096], tmp[4096 + 8];
+    char **paths;
+    uint32_t interface_count = 0, message_count = 0;
+    uint32_t i, j;
+    int fd, rc = -1;
+    FILE *fp;
+
+    paths = calloc(count, sizeof *paths);
+    keys = calloc(count, sizeof *keys);
+    if (paths == NULL || keys == NULL)
+        goto out;
+
+    if (cache_get_keys(files, count, paths, keys) < 0 ||
+        cache_get_path(paths, count, path, sizeof path, 1) < 0)
+        goto out;
+
+    while (analyzer->interfaces[interface_count] != NULL) {
+        interface = analyzer->interfaces[interface_count];
+        message_count += interface->method_count + interface->event_count;
+        interface_count++;
+    }
+
+    cache_interfaces = calloc(interface_count, sizeof *cache_interfaces);
+    cache_messages = calloc(message_count, sizeof *cache_messages);
+    strings.capacity = 4096;
+    strings.data = malloc(strings.capacity);
+    if (cache_interfaces == NULL || cache_messages == NULL || strings.data == NULL)
+        goto out;
+
+    // offset 0 is the empty string, for NULL
+    strings.data[0] = '\0';
+    strings.size = 1;
+
+    for (i = 0; i < (uint32_t) count; i++)
+        keys[i].path = cache_add_string(&strings, paths[i]);
+
+    message_count = 0;
+    for (i = 0; i < interface_count; i++) {
+        interface = analyzer->interfaces[i];
+        cache_interfaces[i].name = cache_add_string(&strings, interface->name);
+        cache_interfaces[i].method_count = interface->method_count;
+        cache_interfaces[i].event_count = interface->event_count;
+        cache_interfaces[i].first_message = message_count;
+        for (j = 0; j < (uint32_t) interface->method_count; j++)
+            cache_add_message(&strings, analyzer, interface->methods[j],
+                              &cache_messages[message_count++]);
+        for (j = 0; j < (uint32_t) interface->event_count; j++)
+            cache_add_message(&strings, analyzer, interface->events[j],
+                              &cache_messages[message_count++]);
+    }
+
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, TRACER_CACHE_MAGIC, sizeof TRACER_CACHE_MAGIC);
+    header.version = TRACER_CACHE_VERSION;
+    header.file_count = count;
+    header.interface_count = interface_count;
+    header.message_count = message_count;
+    header.strings_size = strings.size;
+
+    // written aside and renamed, so a concurrent run never maps a partial file
+    snprintf(tmp, sizeof tmp, "%s.XXXXXX", path);
+    fd = mkstemp(tmp);
+    if (fd < 0)
+        goto out;
+
+    fp = fdopen(fd, "w");
+    if (fp == NULL) {
+        close(fd);
+        unlink(tmp);
+        goto out;
+    }
+
+    fwrite(&header, sizeof header, 1, fp);
+    fwrite(keys, sizeof *keys, count, fp);
+    fwrite(cache_interfaces, sizeof *cache_interfaces, interface_count, fp);
+    fwrite(cache_messages, sizeof *cache_messages, message_count, fp);
+    fwrite(strings.data, 1, strings.size, fp);
+
+    if (fclose(fp) != 0 || rename(tmp, path) < 0) {
+        unlink(tmp);
+        goto out;
+    }
+
+    rc = 0;
+
+  out:
+    if (paths != NULL)
+        cache_free_paths(paths, count);
+    free(keys);
+    free(cache_interfaces);
+    free(cache_messages);
+    free(strings.data);
+    return rc;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef TRACER_CACHE_H
+#define TRACER_CACHE_H
+
+#include <stdint.h>
+
+#include "tracer-analyzer.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define TRACER_CACHE_MAGIC "WLTPROT"
+#define TRACER_CACHE_VERSION 1
+
+// The protocol cache holds the finalized interface and message tables of a list of protocol files,
+// so they are mapped instead of parsed on later runs. It lives in $XDG_CACHE_HOME/wayland-tracer,
+// one file per list of protocol files, and is rebuilt when any of them changes.
+//
+// Layout: header, files, interfaces, messages, then the strings. Strings are offsets in the string
+// table, offset 0 is the empty string. The cache is only meant for the host which wrote it.
+struct tracer_cache_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t file_count;
+    uint32_t interface_count;
+    uint32_t message_count;
+    uint32_t strings_size;
+    uint32_t padding;
+};
+
+// key of a protocol file
+struct tracer_cache_file
+{
+    uint64_t mtime_sec;
+    uint64_t mtime_nsec;
+    uint64_t size;
+    uint64_t hash;              // of the content
+    uint32_t path;              // resolved with realpath()
+    uint32_t padding;
+};
+
+struct tracer_cache_interface
+{
+    uint32_t name;
+    uint32_t method_count;
+    uint32_t event_count;
+    uint32_t first_message;     // methods first, then events
+};
+
+struct tracer_cache_message
+{
+    uint32_t name;
+    uint32_t signature;
+    uint32_t new_interface_name;
+    int32_t type_index;         // -1 if the message creates no typed object
+    uint32_t arg_count;
+    uint32_t destructor;
+};
+
+int tracer_cache_load(struct tracer_analyzer *analyzer, const char **files, int count);
+int tracer_cache_save(struct tracer_analyzer *analyzer, const char **files, int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,150 @@
+// -*- mode: C; c-basic-offset: 4 -*-
+
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+#include "tracer-clock.h"
+
+/**************************************************************************************************/
+
+// Time over which the TSC frequency is measured
+#define CLOCK_CALIBRATION_NS 20000000
+
+// TSC to ns conversion: ns = base_ns + ((tsc - base_tsc) * mult) >> 32. The clock is set once
+// before any thread is started, then only read.
+static struct
+{
+    int source;
+    uint64_t base_tsc;
+    uint64_t base_ns;
+    uint64_t mult;
+} tracer_clock;
+
+static uint64_t
+clock_monotonic_ns(void)
+{
+    struct timespec tp;
+
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+
+    return (uint64_t) tp.tv_sec * 1000000000 + tp.tv_nsec;
+}
+
+#if defined(__x86_64__)
+
+// Only a TSC which ticks at a constant rate in every P- and C-state can be used as a clock
+static int
+clock_tsc_is_invariant(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007)
+        return 0;
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0)
+        return 0;
+
+    return (edx >> 8) & 1;
+}
+
+static int
+clock_tsc_calibrate(void)
+{
+    struct timespec delay = { 0, CLOCK_CALIBRATION_NS };
+    uint64_t tsc0, tsc1, ns0, ns1;
+
+    if (!clock_tsc_is_invariant())
+        return -1;
+
+    ns0 = clock_monotonic_ns();
+    tsc0 = __builtin_ia32_rdtsc();
+    while (nanosleep(&delay, &delay) < 0 && errno == EINTR)
+        ;
+    ns1 = clock_monotonic_ns();
+    tsc1 = __builtin_ia32_rdtsc();
+
+    if (tsc1 <= tsc0 || ns1 <= ns0)
+        return -1;
+
+    tracer_clock.mult = ((ns1 - ns0) << 32) / (tsc1 - tsc0);
+    tracer_clock.base_tsc = tsc1;
+    tracer_clock.base_ns = ns1;
+
+    return 0;
+}
+
+#endif
+
+// Select the source of tracer_monotonic_time(), before any thread is started
+int
+tracer_clock_init(int source)
+{
+    if (source == TRACER_CLOCK_MONOTONIC) {
+        tracer_clock.source = source;
+        return 0;
+    }
+
+#if defined(__x86_64__)
+    if (clock_tsc_calibrate() == 0) {
+        tracer_clock.source = source;
+        return 0;
+    }
+#endif
+
+    errno = ENOTSUP;
+    return -1;
+}
+
+// Timestamp in ns, on the CLOCK_MONOTONIC time line
+uint64_t
+tracer_monotonic_time(void)
+{
+#if defined(__x86_64__)
+    if (tracer_clock.source == TRACER_CLOCK_TSC) {
+        // signed, the TSC of another CPU can be slightly behind the calibration
+        __extension__ __int128 delta = (int64_t) (__builtin_ia32_rdtsc() - tracer_clock.base_tsc);
+        return tracer_clock.base_ns + (int64_t) ((delta * tracer_clock.mult) >> 32);
+    }
+#endif
+
+    return clock_monotonic_ns();
+}
+
+// CLOCK_REALTIME minus the timestamps, in ns
+int64_t
+tracer_clock_realtime_offset(void)
+{
+    struct timespec realtime;
+    uint64_t monotonic;
+
+    monotonic = tracer_monotonic_time();
+    clock_gettime(CLOCK_REALTIME, &realtime);
+
+    return ((int64_t) realtime.tv_sec * 1000000000 + realtime.tv_nsec) - (int64_t) monotonic;
+}
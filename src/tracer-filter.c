@@ -0,0 +1,213 @@
+// -*- mode: C; c-basic-offset: 4 -*-
+
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wayland-private.h"
+#include "tracer.h"
+#include "tracer-analyzer.h"
+#include "tracer-filter.h"
+
+/**************************************************************************************************/
+
+int
+tracer_filter_add_rule(struct wl_list *rules, const char *spec, int exclude)
+{
+    struct tracer_filter_rule *rule;
+    const char *colon;
+    size_t length;
+    char *end;
+
+    rule = malloc(sizeof *rule);
+    if (rule == NULL)
+        return -1;
+
+    rule->exclude = exclude;
+    rule->side = -1;
+    rule->instance = -1;
+
+    while ((colon = strchr(spec, ':')) != NULL) {
+        length = colon - spec;
+        if (length == 7 && strncmp(spec, "request", 7) == 0) {
+            rule->side = TRACER_CLIENT_SIDE;
+        }
+        else if (length == 5 && strncmp(spec, "event", 5) == 0) {
+            rule->side = TRACER_SERVER_SIDE;
+        }
+        else {
+            rule->instance = strtol(spec, &end, 10);
+            if (end != colon || length == 0 || rule->instance < 0) {
+                fprintf(stderr, "Unknown filter qualifier '%.*s'\n", (int) length, spec);
+                free(rule);
+                errno = EINVAL;
+                return -1;
+            }
+        }
+        spec = colon + 1;
+    }
+
+    // a bare interface name stands for all its messages
+    length = strlen(spec);
+    rule->pattern = malloc(length + 3);
+    if (rule->pattern == NULL) {
+        free(rule);
+        return -1;
+    }
+    memcpy(rule->pattern, spec, length + 1);
+    if (strchr(spec, '.') == NULL)
+        memcpy(rule->pattern + length, ".*", 3);
+
+    wl_list_insert(rules->prev, &rule->link);
+
+    return 0;
+}
+
+/**************************************************************************************************/
+
+// Shown if it matches a --filter rule, or if there is none, and no --exclude rule
+static int
+filter_evaluate(struct wl_list *rules, const char *name, int side, int instance)
+{
+    struct tracer_filter_rule *rule;
+    int filtered = 0, included = 0;
+
+    wl_list_for_each(rule, rules, link) {
+        if (!rule->exclude)
+            filtered = 1;
+        if ((rule->side != -1 && rule->side != side) ||
+            (rule->instance != -1 && rule->instance != instance) ||
+            fnmatch(rule->pattern, name, 0) != 0)
+            continue;
+        if (rule->exclude)
+            return 0;
+        included = 1;
+    }
+
+    return !filtered || included;
+}
+
+static void
+filter_compile_messages(struct tracer_filter *filter, uint8_t *bits, uint32_t bit,
+                        struct tracer_interface *interface, struct tracer_message **messages,
+                        int count, int side, int instance)
+{
+    char name[256];
+    int i;
+
+    for (i = 0; i < count; i++, bit++) {
+        snprintf(name, sizeof name, "%s.%s", interface->name, messages[i]->name);
+        if (filter_evaluate(filter->rules, name, side, instance))
+            bits[bit >> 3] |= 1 << (bit & 7);
+    }
+}
+
+static uint8_t *
+filter_compile(struct tracer_filter *filter, int instance)
+{
+    struct tracer_interface **interfaces = filter->analyzer->interfaces;
+    struct tracer_interface *interface;
+    uint8_t *bits;
+    int i;
+
+    bits = calloc(filter->bit_count / 8 + 1, 1);
+    if (bits == NULL)
+        return NULL;
+
+    for (i = 0; interfaces[i] != NULL; i++) {
+        interface = interfaces[i];
+        filter_compile_messages(filter, bits, filter->base[i], interface, interface->methods,
+                                interface->method_count, TRACER_CLIENT_SIDE, instance);
+        filter_compile_messages(filter, bits, filter->base[i] + interface->method_count,
+                                interface, interface->events, interface->event_count,
+                                TRACER_SERVER_SIDE, instance);
+    }
+
+    return bits;
+}
+
+struct tracer_filter *
+tracer_filter_create(struct tracer_analyzer *analyzer, struct wl_list *rules)
+{
+    struct tracer_interface **interfaces = analyzer->interfaces;
+    struct tracer_filter_rule *rule;
+    struct tracer_filter *filter;
+    int i, count;
+
+    filter = calloc(1, sizeof *filter);
+    if (filter == NULL)
+        return NULL;
+
+    for (count = 0; interfaces[count] != NULL; count++)
+        ;
+
+    filter->analyzer = analyzer;
+    filter->rules = rules;
+    filter->base = malloc((count + 1) * sizeof *filter->base);
+    if (filter->base == NULL) {
+        free(filter);
+        return NULL;
+    }
+
+    for (i = 0; i < count; i++) {
+        filter->base[i] = filter->bit_count;
+        filter->bit_count += interfaces[i]->method_count + interfaces[i]->event_count;
+    }
+
+    wl_list_for_each(rule, rules, link) {
+        if (rule->instance != -1)
+            filter->per_instance = 1;
+    }
+
+    if (!filter->per_instance) {
+        filter->bits = filter_compile(filter, -1);
+        if (filter->bits == NULL) {
+            free(filter->base);
+            free(filter);
+            return NULL;
+        }
+    }
+
+    return filter;
+}
+
+// Bitmap of the messages shown for an instance, released with tracer_filter_put()
+uint8_t *
+tracer_filter_get(struct tracer_filter *filter, int instance)
+{
+    if (!filter->per_instance)
+        return filter->bits;
+
+    return filter_compile(filter, instance);
+}
+
+void
+tracer_filter_put(struct tracer_filter *filter, uint8_t *bits)
+{
+    if (filter->per_instance)
+        free(bits);
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef TRACER_FILTER_H
+#define TRACER_FILTER_H
+
+#include <stdint.h>
+
+#include "wayland-util.h"
+#include "tracer.h"
+#include "tracer-analyzer.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// A --filter or --exclude rule, "[QUALIFIER:]...GLOB"
+//   QUALIFIER is "request", "event" or an instance id, GLOB is matched against
+//   "interface.message", a GLOB without a dot matches all the messages of the interfaces
+struct tracer_filter_rule
+{
+    int exclude;
+    int side;                   // side of the sender, -1 for both directions
+    int instance;               // -1 for all the instances
+    char *pattern;
+    struct wl_list link;
+};
+
+// The rules are compiled into a bitmap with one bit per message, set if the message is shown.
+// The messages of an interface start at the bit base[type_index], requests then events. Rules
+// which name an instance need a bitmap per instance, otherwise all the instances share one.
+struct tracer_filter
+{
+    struct tracer_analyzer *analyzer;
+    struct wl_list *rules;
+    uint32_t *base;
+    uint32_t bit_count;
+    int per_instance;
+    uint8_t *bits;
+};
+
+int tracer_filter_add_rule(struct wl_list *rules, const char *spec, int exclude);
+
+struct tracer_filter *tracer_filter_create(struct tracer_analyzer *analyzer, struct wl_list *rules);
+uint8_t *tracer_filter_get(struct tracer_filter *filter, int instance);
+void tracer_filter_put(struct tracer_filter *filter, uint8_t *bits);
+
+static inline int
+tracer_filter_shows(const struct tracer_filter *filter, const uint8_t *bits,
+                    const struct tracer_interface *interface, int side, int opcode)
+{
+    uint32_t bit = filter->base[interface->type_index] + opcode +
+        (side == TRACER_CLIENT_SIDE ? 0 : interface->method_count);
+
+    return bits[bit >> 3] & (1 << (bit & 7));
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
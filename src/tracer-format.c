@@ -0,0 +1,183 @@
+// -*- mode: C; c-basic-offset: 4 -*-
+
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "wayland-private.h"
+#include "tracer.h"
+#include "tracer-format.h"
+
+/**************************************************************************************************/
+
+// Longest encoding of a number, "-2147483648" or "-8388608.000000"
+#define FORMAT_NUMBER_MAX 16
+
+static const char hex_digits[] = "0123456789abcdef";
+
+void
+tracer_format_init(struct tracer_formatter *f, struct tracer_instance *instance)
+{
+    f->instance = instance;
+    f->size = 0;
+}
+
+void
+tracer_format_flush(struct tracer_formatter *f)
+{
+    if (f->size > 0)
+        tracer_output_write(f->instance, f->data, f->size);
+    f->size = 0;
+}
+
+/**************************************************************************************************/
+
+// Digits of value, written backwards from end, return the first one
+static inline char *
+format_decimal(char *end, uint32_t value)
+{
+    do {
+        *--end = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+
+    return end;
+}
+
+static inline void
+format_number(struct tracer_formatter *f, uint32_t value, int negative)
+{
+    char digits[FORMAT_NUMBER_MAX];
+    char *start = format_decimal(digits + sizeof digits, value);
+
+    if (negative)
+        *--start = '-';
+    tracer_format_bytes(f, start, digits + sizeof digits - start);
+}
+
+/**************************************************************************************************/
+
+void
+tracer_format_bytes(struct tracer_formatter *f, const char *s, size_t count)
+{
+    size_t chunk;
+
+    if (count <= sizeof f->data - f->size) {
+        memcpy(f->data + f->size, s, count);
+        f->size += count;
+        return;
+    }
+
+    while (count > 0) {
+        chunk = sizeof f->data - f->size;
+        if (chunk == 0) {
+            tracer_format_flush(f);
+            chunk = sizeof f->data;
+        }
+        if (chunk > count)
+            chunk = count;
+        memcpy(f->data + f->size, s, chunk);
+        f->size += chunk;
+        s += chunk;
+        count -= chunk;
+    }
+}
+
+void
+tracer_format_string(struct tracer_formatter *f, const char *s)
+{
+    if (s == NULL)
+        s = "(null)";
+
+    tracer_format_bytes(f, s, strlen(s));
+}
+
+void
+tracer_format_uint(struct tracer_formatter *f, uint32_t value)
+{
+    format_number(f, value, 0);
+}
+
+void
+tracer_format_int(struct tracer_formatter *f, int32_t value)
+{
+    format_number(f, value < 0 ? -(uint32_t) value : (uint32_t) value, value < 0);
+}
+
+// A 24.8 fixed-point value is k / 256 with k an integer, its fractional part is exactly
+// k * 390625 / 10^8: printf() rounds it to 6 digits, ties to even
+void
+tracer_format_fixed(struct tracer_formatter *f, wl_fixed_t value)
+{
+    uint32_t magnitude = value < 0 ? -(uint32_t) value : (uint32_t) value;
+    uint32_t integer = magnitude >> 8;
+    uint32_t units = (magnitude & 0xff) * 390625;
+    uint32_t fraction = units / 100, rest = units % 100;
+    char digits[FORMAT_NUMBER_MAX];
+    char *start = digits + sizeof digits;
+
+    if (rest > 50 || (rest == 50 && (fraction & 1)))
+        fraction++;
+
+    // fraction < 10^6 since k < 256
+    for (int i = 0; i < 6; i++) {
+        *--start = '0' + fraction % 10;
+        fraction /= 10;
+    }
+    *--start = '.';
+    start = format_decimal(start, integer);
+    if (value < 0)
+        *--start = '-';
+
+    tracer_format_bytes(f, start, digits + sizeof digits - start);
+}
+
+void
+tracer_format_hex(struct tracer_formatter *f, const void *data, size_t count)
+{
+    const unsigned char *bytes = data;
+    size_t chunk;
+    char *p;
+
+    while (count > 0) {
+        chunk = (sizeof f->data - f->size) / 3;
+        if (chunk == 0) {
+            tracer_format_flush(f);
+            chunk = sizeof f->data / 3;
+        }
+        if (chunk > count)
+            chunk = count;
+
+        p = f->data + f->size;
+        for (size_t i = 0; i < chunk; i++) {
+            p[0] = hex_digits[bytes[i] >> 4];
+            p[1] = hex_digits[bytes[i] & 0xf];
+            p[2] = ' ';
+            p += 3;
+        }
+        f->size += chunk * 3;
+        bytes += chunk;
+        count -= chunk;
+    }
+}
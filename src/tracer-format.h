@@ -0,0 +1,67 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef TRACER_FORMAT_H
+#define TRACER_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wayland-util.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define TRACER_FORMAT_SIZE 4096
+
+struct tracer_instance;
+
+// Formatter for the hot parts of the text output: the arguments of the messages and the hex
+// dumps. The encoders write straight into a buffer, which goes to the output of the instance with
+// tracer_output_write() when full or flushed. The output is the same as the printf() formats
+// named below.
+struct tracer_formatter
+{
+    struct tracer_instance *instance;
+    size_t size;
+    char data[TRACER_FORMAT_SIZE];
+};
+
+void tracer_format_init(struct tracer_formatter *f, struct tracer_instance *instance);
+void tracer_format_flush(struct tracer_formatter *f);
+
+#define tracer_format_literal(f, s) tracer_format_bytes(f, s, sizeof(s) - 1)
+
+void tracer_format_bytes(struct tracer_formatter *f, const char *s, size_t count);
+void tracer_format_string(struct tracer_formatter *f, const char *s);      // "%s"
+void tracer_format_uint(struct tracer_formatter *f, uint32_t value);      // "%u"
+void tracer_format_int(struct tracer_formatter *f, int32_t value);        // "%i"
+void tracer_format_fixed(struct tracer_formatter *f, wl_fixed_t value);   // "%lf", exact value
+void tracer_format_hex(struct tracer_formatter *f, const void *data, size_t count);  // "%02x " each
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,485 @@
+// -*- mode: C; c-basic-offset: 4 -*-
+
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wayland-private.h"
+#include "tracer.h"
+#include "tracer-analyzer.h"
+#include "tracer-clock.h"
+#include "tracer-latency.h"
+#include "tracer-writer.h"
+
+/**************************************************************************************************/
+
+static const char *transit_names[2] = {
+    [TRACER_SERVER_SIDE] = "transit.event",
+    [TRACER_CLIENT_SIDE] = "transit.request"
+};
+
+struct tracer_latency *
+tracer_latency_create(struct tracer_analyzer *analyzer, const char *json_file)
+{
+    struct tracer_interface **interfaces = analyzer->interfaces;
+    struct tracer_interface **ptype;
+    struct tracer_latency *latency;
+    struct tracer_message *message;
+    uint32_t count = 0;
+    int i, j;
+
+    latency = calloc(1, sizeof *latency);
+    if (latency == NULL)
+        return NULL;
+
+    ptype = tracer_analyzer_lookup_type(analyzer, "wl_callback");
+    latency->callback = ptype == NULL ? NULL : *ptype;
+
+    for (i = 0; latency->callback != NULL && interfaces[i] != NULL; i++) {
+        for (j = 0; j < interfaces[i]->method_count; j++) {
+            message = interfaces[i]->methods[j];
+            if (message->types != NULL && *message->types == latency->callback)
+                count++;
+        }
+    }
+
+    latency->kinds = calloc(count + 1, sizeof *latency->kinds);
+    latency->kind_names = calloc(count + 1, sizeof *latency->kind_names);
+    latency->round_trip = calloc(count + 1, sizeof *latency->round_trip);
+    if (latency->kinds == NULL || latency->kind_names == NULL || latency->round_trip == NULL)
+        goto err;
+
+    for (i = 0; latency->callback != NULL && interfaces[i] != NULL; i++) {
+        for (j = 0; j < interfaces[i]->method_count; j++) {
+            message = interfaces[i]->methods[j];
+            if (message->types == NULL || *message->types != latency->callback)
+                continue;
+
+            char *name = malloc(strlen(interfaces[i]->name) + strlen(message->name) + 2);
+            if (name == NULL)
+                goto err;
+            sprintf(name, "%s.%s", interfaces[i]->name, message->name);
+            latency->kinds[latency->kind_count] = message;
+            latency->kind_names[latency->kind_count] = name;
+            latency->kind_count++;
+        }
+    }
+
+    if (json_file != NULL) {
+        latency->json = fopen(json_file, "w");
+        if (latency->json == NULL)
+            goto err;
+        fprintf(latency->json, "{\"unit\": \"ns\", \"instances\": [");
+    }
+
+    return latency;
+
+  err:
+    for (i = 0; latency->kind_names != NULL && i < (int) latency->kind_count; i++)
+        free(latency->kind_names[i]);
+    free(latency->kinds);
+    free(latency->kind_names);
+    free(latency->round_trip);
+    free(latency);
+    return NULL;
+}
+
+struct tracer_latency_instance *
+tracer_latency_instance_create(struct tracer_latency *latency, int id)
+{
+    struct tracer_latency_instance *instance;
+
+    instance = calloc(1, sizeof *instance);
+    if (instance == NULL)
+        return NULL;
+
+    instance->id = id;
+    instance->round_trip = calloc(latency->kind_count + 1, sizeof *instance->round_trip);
+    if (instance->round_trip == NULL) {
+        free(instance);
+        return NULL;
+    }
+
+    return instance;
+}
+
+/**************************************************************************************************/
+
+// Queue a read of side whose messages are forwarded up to position end of the output stream of the
+// peer. Without memory, the read is not measured.
+void
+tracer_latency_read(struct tracer_latency_instance *instance, int side, uint64_t time,
+                    uint32_t end, uint32_t count)
+{
+    struct tracer_latency_unsent *unsent = &instance->unsent[side];
+    struct tracer_latency_read *reads, *read;
+    uint32_t capacity;
+
+    if (unsent->first + unsent->count == unsent->capacity) {
+        if (unsent->first > 0) {
+            memmove(unsent->reads, unsent->reads + unsent->first,
+                    unsent->count * sizeof *unsent->reads);
+            unsent->first = 0;
+        }
+        else {
+            capacity = unsent->capacity == 0 ? 16 : unsent->capacity * 2;
+            reads = realloc(unsent->reads, capacity * sizeof *reads);
+            if (reads == NULL)
+                return;
+            unsent->reads = reads;
+            unsent->capacity = capacity;
+        }
+    }
+
+    read = &unsent->reads[unsent->first + unsent->count++];
+    read->time = time;
+    read->end = end;
+    read->count = count;
+}
+
+// The peer of side was sent its output stream up to position sent: the messages of the reads
+// ending there have left the tracer
+void
+tracer_latency_sent(struct tracer_latency_instance *instance, int side, uint32_t sent)
+{
+    struct tracer_latency_unsent *unsent = &instance->unsent[side];
+    struct tracer_latency_read *read;
+    uint64_t now;
+
+    if (unsent->count == 0)
+        return;
+
+    now = tracer_monotonic_time();
+    while (unsent->count > 0) {
+        read = &unsent->reads[unsent->first];
+        // positions wrap around
+        if ((int32_t) (sent - read->end) < 0)
+            break;
+        tracer_histogram_record(&instance->transit[side], now - read->time, read->count);
+        unsent->first++;
+        unsent->count--;
+    }
+
+    if (unsent->count == 0)
+        unsent->first = 0;
+}
+
+/**************************************************************************************************/
+
+// Return the first new_id of a message checked by tracer_plan_check(), 0 if there is none
+static uint32_t
+latency_new_id(const struct tracer_plan *plan, const char *buf)
+{
+    const uint32_t *p = (const uint32_t *) buf + 2;
+    uint32_t length;
+
+    for (int i = 0; i < plan->arg_count; i++) {
+        switch (plan->args[i].kind) {
+        case TRACER_ARG_NEW_ID:
+            return *p;
+        case TRACER_ARG_STRING:
+        case TRACER_ARG_ARRAY:
+            length = *p++;
+            p += (length + sizeof *p - 1) / sizeof *p;
+            break;
+        case TRACER_ARG_NEW_ID_DYNAMIC:
+            return 0;
+        case TRACER_ARG_FD:
+            break;
+        default:
+            p++;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+// Start the round-trip of a request creating a wl_callback
+void
+tracer_latency_request(struct tracer_latency *latency, struct tracer_latency_instance *instance,
+                       const struct tracer_message *message, const char *buf, uint64_t time)
+{
+    struct tracer_latency_pending *pending;
+    uint32_t id, kind, count;
+
+    for (kind = 0; kind < latency->kind_count; kind++) {
+        if (latency->kinds[kind] == message)
+            break;
+    }
+
+    id = latency_new_id(message->plan, buf);
+    if (kind == latency->kind_count || id == 0 || id >= TRACER_LATENCY_MAX_ID)
+        return;
+
+    if (id >= instance->pending_count) {
+        for (count = instance->pending_count == 0 ? 64 : instance->pending_count; count <= id;
+             count *= 2)
+            ;
+        pending = realloc(instance->pending, count * sizeof *pending);
+        if (pending == NULL)
+            return;
+        memset(pending + instance->pending_count, 0,
+               (count - instance->pending_count) * sizeof *pending);
+        instance->pending = pending;
+        instance->pending_count = count;
+    }
+
+    if (instance->round_trip[kind] == NULL) {
+        instance->round_trip[kind] = calloc(1, sizeof(struct tracer_histogram));
+        if (instance->round_trip[kind] == NULL)
+            return;
+    }
+
+    instance->pending[id].time = time;
+    instance->pending[id].kind = kind;
+}
+
+/**************************************************************************************************/
+
+static uint64_t
+histogram_bucket_low(uint32_t index)
+{
+    uint32_t shift;
+
+    if (index < TRACER_HISTOGRAM_SUB_COUNT)
+        return index;
+
+    shift = (index >> TRACER_HISTOGRAM_SUB_BITS) - 1;
+    return (uint64_t) (TRACER_HISTOGRAM_SUB_COUNT + (index & (TRACER_HISTOGRAM_SUB_COUNT - 1)))
+        << shift;
+}
+
+static uint64_t
+histogram_bucket_high(uint32_t index)
+{
+    if (index < TRACER_HISTOGRAM_SUB_COUNT)
+        return index;
+
+    return histogram_bucket_low(index) +
+        (((uint64_t) 1 << ((index >> TRACER_HISTOGRAM_SUB_BITS) - 1)) - 1);
+}
+
+// Highest value of the bucket holding the percentile, within the recorded range
+uint64_t
+tracer_histogram_percentile(const struct tracer_histogram *histogram, double percentile)
+{
+    uint64_t rank, seen = 0, value;
+    uint32_t i;
+
+    if (histogram->count == 0)
+        return 0;
+
+    rank = (uint64_t) (histogram->count * percentile / 100.0 + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    for (i = 0; i < TRACER_HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank)
+            break;
+    }
+
+    value = histogram_bucket_high(i);
+    if (value > histogram->max)
+        value = histogram->max;
+    if (value < histogram->min)
+        value = histogram->min;
+    return value;
+}
+
+static void
+histogram_add(struct tracer_histogram *to, const struct tracer_histogram *from)
+{
+    if (from->count == 0)
+        return;
+
+    if (to->count == 0 || from->min < to->min)
+        to->min = from->min;
+    if (from->max > to->max)
+        to->max = from->max;
+    to->count += from->count;
+    to->sum += from->sum;
+    for (int i = 0; i < TRACER_HISTOGRAM_BUCKETS; i++)
+        to->buckets[i] += from->buckets[i];
+}
+
+/**************************************************************************************************/
+
+static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+static const char *percentile_names[] = { "p50", "p90", "p99", "p999" };
+
+static void
+latency_print_histogram(struct tracer *tracer, const char *name,
+                        const struct tracer_histogram *histogram)
+{
+    unsigned int i;
+
+    if (histogram == NULL || histogram->count == 0)
+        return;
+
+    tracer_print(tracer, "%-24s %10" PRIu64 " %10.3f", name, histogram->count,
+                 histogram->min / 1e3);
+    for (i = 0; i < sizeof percentiles / sizeof percentiles[0]; i++)
+        tracer_print(tracer, " %10.3f", tracer_histogram_percentile(histogram, percentiles[i]) / 1e3);
+    tracer_print(tracer, " %10.3f %10.3f\n", histogram->max / 1e3,
+                 (double) histogram->sum / histogram->count / 1e3);
+}
+
+static void
+latency_print(struct tracer *tracer, const char *title, const struct tracer_histogram *transit,
+              struct tracer_histogram **round_trip, const struct tracer_histogram *total_round_trip)
+{
+    struct tracer_latency *latency = tracer->latency;
+    uint32_t kind;
+
+    tracer_print(tracer, "==== latency of %s, in us\n", title);
+    tracer_print(tracer, "%-24s %10s %10s %10s %10s %10s %10s %10s %10s\n", "",
+                 "count", "min", "p50", "p90", "p99", "p99.9", "max", "mean");
+    latency_print_histogram(tracer, transit_names[TRACER_CLIENT_SIDE],
+                            &transit[TRACER_CLIENT_SIDE]);
+    latency_print_histogram(tracer, transit_names[TRACER_SERVER_SIDE],
+                            &transit[TRACER_SERVER_SIDE]);
+    for (kind = 0; kind < latency->kind_count; kind++) {
+        latency_print_histogram(tracer, latency->kind_names[kind],
+                                round_trip != NULL ? round_trip[kind] : &total_round_trip[kind]);
+    }
+    tracer_print(tracer, "\n");
+}
+
+static void
+latency_json_histogram(FILE *fp, int *first, const char *name,
+                       const struct tracer_histogram *histogram)
+{
+    unsigned int i;
+    int first_bucket = 1;
+
+    if (histogram == NULL || histogram->count == 0)
+        return;
+
+    fprintf(fp, "%s\"%s\": {\"count\": %" PRIu64 ", \"min\": %" PRIu64 ", \"max\": %" PRIu64
+            ", \"mean\": %.1f", *first ? "" : ", ", name, histogram->count, histogram->min,
+            histogram->max, (double) histogram->sum / histogram->count);
+    for (i = 0; i < sizeof percentiles / sizeof percentiles[0]; i++)
+        fprintf(fp, ", \"%s\": %" PRIu64, percentile_names[i],
+                tracer_histogram_percentile(histogram, percentiles[i]));
+
+    // non-empty buckets only, as [lowest value, highest value, count]
+    fprintf(fp, ", \"buckets\": [");
+    for (i = 0; i < TRACER_HISTOGRAM_BUCKETS; i++) {
+        if (histogram->buckets[i] == 0)
+            continue;
+        fprintf(fp, "%s[%" PRIu64 ", %" PRIu64 ", %" PRIu64 "]", first_bucket ? "" : ", ",
+                histogram_bucket_low(i), histogram_bucket_high(i), histogram->buckets[i]);
+        first_bucket = 0;
+    }
+    fprintf(fp, "]}");
+    *first = 0;
+}
+
+static void
+latency_json(struct tracer_latency *latency, const struct tracer_histogram *transit,
+             struct tracer_histogram **round_trip, const struct tracer_histogram *total_round_trip)
+{
+    uint32_t kind;
+    int first = 1;
+
+    fprintf(latency->json, "{");
+    latency_json_histogram(latency->json, &first, transit_names[TRACER_CLIENT_SIDE],
+                           &transit[TRACER_CLIENT_SIDE]);
+    latency_json_histogram(latency->json, &first, transit_names[TRACER_SERVER_SIDE],
+                           &transit[TRACER_SERVER_SIDE]);
+    for (kind = 0; kind < latency->kind_count; kind++) {
+        latency_json_histogram(latency->json, &first, latency->kind_names[kind],
+                               round_trip != NULL ? round_trip[kind] : &total_round_trip[kind]);
+    }
+    fprintf(latency->json, "}");
+}
+
+/**************************************************************************************************/
+
+// Report the latencies of the instance and add them to the total
+void
+tracer_latency_instance_destroy(struct tracer *tracer, struct tracer_latency_instance *instance)
+{
+    struct tracer_latency *latency = tracer->latency;
+    char title[32];
+    uint32_t kind;
+
+    snprintf(title, sizeof title, "instance %d", instance->id);
+    latency_print(tracer, title, instance->transit, instance->round_trip, NULL);
+
+    if (latency->json != NULL) {
+        fprintf(latency->json, "%s{\"id\": %d, \"histograms\": ",
+                latency->json_count == 0 ? "" : ", ", instance->id);
+        latency_json(latency, instance->transit, instance->round_trip, NULL);
+        fprintf(latency->json, "}");
+        latency->json_count++;
+    }
+
+    histogram_add(&latency->transit[TRACER_CLIENT_SIDE], &instance->transit[TRACER_CLIENT_SIDE]);
+    histogram_add(&latency->transit[TRACER_SERVER_SIDE], &instance->transit[TRACER_SERVER_SIDE]);
+    for (kind = 0; kind < latency->kind_count; kind++) {
+        if (instance->round_trip[kind] != NULL) {
+            histogram_add(&latency->round_trip[kind], instance->round_trip[kind]);
+            free(instance->round_trip[kind]);
+        }
+    }
+
+    free(instance->round_trip);
+    free(instance->pending);
+    free(instance->unsent[TRACER_CLIENT_SIDE].reads);
+    free(instance->unsent[TRACER_SERVER_SIDE].reads);
+    free(instance);
+}
+
+// Report the instances still running and the total, at exit
+void
+tracer_latency_report(struct tracer *tracer)
+{
+    struct tracer_latency *latency = tracer->latency;
+    struct tracer_instance *instance;
+
+    wl_list_for_each(instance, &tracer->instance_list, link) {
+        if (instance->latency != NULL) {
+            tracer_latency_instance_destroy(tracer, instance->latency);
+            instance->latency = NULL;
+        }
+    }
+
+    latency_print(tracer, "all instances", latency->transit, NULL, latency->round_trip);
+    tracer_writer_flush(tracer->writer);
+
+    if (latency->json != NULL) {
+        fprintf(latency->json, "], \"total\": ");
+        latency_json(latency, latency->transit, NULL, latency->round_trip);
+        fprintf(latency->json, "}\n");
+        if (fclose(latency->json) != 0)
+            fprintf(stderr, "Failed to write the latency report: %m\n");
+        latency->json = NULL;
+    }
+}
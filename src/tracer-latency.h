@@ -0,0 +1,177 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef TRACER_LATENCY_H
+#define TRACER_LATENCY_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "tracer.h"
+#include "tracer-analyzer.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Log-bucketed histogram of durations in ns: values below 2^TRACER_HISTOGRAM_SUB_BITS have their
+// own bucket, above each power of two is split in 2^TRACER_HISTOGRAM_SUB_BITS linear buckets, so
+// the relative error is below 1/16 over the whole 64-bit range
+#define TRACER_HISTOGRAM_SUB_BITS 4
+#define TRACER_HISTOGRAM_SUB_COUNT (1 << TRACER_HISTOGRAM_SUB_BITS)
+#define TRACER_HISTOGRAM_BUCKETS ((64 - TRACER_HISTOGRAM_SUB_BITS + 1) * TRACER_HISTOGRAM_SUB_COUNT)
+
+// Highest object id with a pending round-trip, the ids of the client are allocated from 1
+#define TRACER_LATENCY_MAX_ID (1 << 20)
+
+struct tracer_histogram
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min, max;
+    uint64_t buckets[TRACER_HISTOGRAM_BUCKETS];
+};
+
+// Request waiting for the first event on the object it created
+struct tracer_latency_pending
+{
+    uint64_t time;              // 0 when there is none
+    uint32_t kind;
+};
+
+// Read whose messages have not all been sent to the peer: they leave the tracer once the bytes sent
+// to the peer reach end, the position in its output stream of the last byte of the read
+struct tracer_latency_read
+{
+    uint64_t time;
+    uint32_t end;
+    uint32_t count;
+};
+
+// Reads of one side in the order they were forwarded, see tracer_latency_sent()
+struct tracer_latency_unsent
+{
+    struct tracer_latency_read *reads;
+    uint32_t first, count, capacity;
+};
+
+// Latencies of an instance: time spent in the tracer by the messages of each direction, and
+// round-trips of the requests creating a wl_callback, one histogram per request
+struct tracer_latency_instance
+{
+    int id;
+    struct tracer_histogram transit[2];  // indexed by side
+    struct tracer_latency_unsent unsent[2];
+    struct tracer_histogram **round_trip;
+    struct tracer_latency_pending *pending;
+    uint32_t pending_count;
+};
+
+// Latency measurements for --latency. Round-trips are timed for the requests with a new_id of
+// type wl_callback (wl_display.sync, wl_surface.frame, ...), each of them is a kind, until the
+// first event on the callback. Instances are reported when they are destroyed and at exit, and
+// added to the total.
+struct tracer_latency
+{
+    struct tracer_interface *callback;
+    struct tracer_message **kinds;
+    char **kind_names;
+    uint32_t kind_count;
+    struct tracer_histogram transit[2];
+    struct tracer_histogram *round_trip;
+    FILE *json;
+    int json_count;             // instances written to the JSON file
+};
+
+struct tracer_latency *tracer_latency_create(struct tracer_analyzer *analyzer,
+                                             const char *json_file);
+struct tracer_latency_instance *tracer_latency_instance_create(struct tracer_latency *latency,
+                                                               int id);
+void tracer_latency_instance_destroy(struct tracer *tracer,
+                                     struct tracer_latency_instance *instance);
+void tracer_latency_report(struct tracer *tracer);
+
+uint64_t tracer_histogram_percentile(const struct tracer_histogram *histogram, double percentile);
+
+void tracer_latency_read(struct tracer_latency_instance *instance, int side, uint64_t time,
+                         uint32_t end, uint32_t count);
+void tracer_latency_sent(struct tracer_latency_instance *instance, int side, uint32_t sent);
+
+void tracer_latency_request(struct tracer_latency *latency, struct tracer_latency_instance *instance,
+                            const struct tracer_message *message, const char *buf, uint64_t time);
+
+static inline uint32_t
+tracer_histogram_index(uint64_t value)
+{
+    int exponent;
+
+    if (value < TRACER_HISTOGRAM_SUB_COUNT)
+        return value;
+
+    exponent = 63 - __builtin_clzll(value);
+    return ((exponent - TRACER_HISTOGRAM_SUB_BITS + 1) << TRACER_HISTOGRAM_SUB_BITS) +
+        ((value >> (exponent - TRACER_HISTOGRAM_SUB_BITS)) & (TRACER_HISTOGRAM_SUB_COUNT - 1));
+}
+
+static inline void
+tracer_histogram_record(struct tracer_histogram *histogram, uint64_t value, uint64_t count)
+{
+    if (histogram->count == 0 || value < histogram->min)
+        histogram->min = value;
+    if (value > histogram->max)
+        histogram->max = value;
+    histogram->count += count;
+    histogram->sum += value * count;
+    histogram->buckets[tracer_histogram_index(value)] += count;
+}
+
+// Called for every message passing tracer_plan_check(), before it is forwarded, time is when it was read
+static inline void
+tracer_latency_message(struct tracer_latency *latency, struct tracer_latency_instance *instance,
+                       int side, uint32_t id, const struct tracer_message *message,
+                       const char *buf, uint64_t time)
+{
+    struct tracer_latency_pending *pending;
+
+    if (side == TRACER_CLIENT_SIDE) {
+        if (message->types != NULL && *message->types == latency->callback &&
+            latency->callback != NULL)
+            tracer_latency_request(latency, instance, message, buf, time);
+        return;
+    }
+
+    if (id >= instance->pending_count || instance->pending[id].time == 0)
+        return;
+
+    pending = &instance->pending[id];
+    if (instance->round_trip[pending->kind] != NULL)
+        tracer_histogram_record(instance->round_trip[pending->kind],
+                                time - pending->time, 1);
+    pending->time = 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
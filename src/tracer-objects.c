@@ -0,0 +1,125 @@
+// -*- mode: C; c-basic-offset: 4 -*-
+
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracer-objects.h"
+
+/**************************************************************************************************/
+
+#define OBJECTS_INITIAL_CAPACITY 64
+
+void
+tracer_objects_init(struct tracer_objects *objects)
+{
+    memset(objects, 0, sizeof *objects);
+}
+
+void
+tracer_objects_release(struct tracer_objects *objects)
+{
+    for (int side = 0; side < 2; side++) {
+        free(objects->interfaces[side]);
+        free(objects->generations[side]);
+    }
+    memset(objects, 0, sizeof *objects);
+}
+
+static int
+objects_grow(struct tracer_objects *objects, int side, uint32_t index)
+{
+    struct tracer_interface **interfaces;
+    uint32_t *generations;
+    uint32_t capacity = objects->capacity[side];
+
+    if (capacity == 0)
+        capacity = OBJECTS_INITIAL_CAPACITY;
+    while (capacity <= index)
+        capacity *= 2;
+
+    interfaces = realloc(objects->interfaces[side], capacity * sizeof *interfaces);
+    if (interfaces == NULL)
+        return -1;
+    objects->interfaces[side] = interfaces;
+
+    generations = realloc(objects->generations[side], capacity * sizeof *generations);
+    if (generations == NULL)
+        return -1;
+    objects->generations[side] = generations;
+
+    memset(interfaces + objects->capacity[side], 0,
+           (capacity - objects->capacity[side]) * sizeof *interfaces);
+    memset(generations + objects->capacity[side], 0,
+           (capacity - objects->capacity[side]) * sizeof *generations);
+    objects->capacity[side] = capacity;
+
+    return 0;
+}
+
+// Create an object, replacing the one with the same id if any. As with wl_map, the id can not be
+// past the end of its range, which keeps a bogus id from allocating the whole range.
+int
+tracer_objects_insert(struct tracer_objects *objects, uint32_t id,
+                      struct tracer_interface *interface)
+{
+    int side = id >= TRACER_SERVER_ID_START;
+    uint32_t index = side ? id - TRACER_SERVER_ID_START : id;
+
+    if (index > TRACER_OBJECTS_MAX) {
+        errno = ENOSPC;
+        return -1;
+    }
+    if (index > objects->count[side]) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (index >= objects->capacity[side] && objects_grow(objects, side, index) < 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (index == objects->count[side])
+        objects->count[side]++;
+    objects->interfaces[side][index] = interface;
+    objects->generations[side][index] =
+        ((objects->generations[side][index] & ~TRACER_OBJECTS_DESTROYED) + 1) &
+        ~TRACER_OBJECTS_DESTROYED;
+
+    return 0;
+}
+
+struct tracer_interface *
+tracer_objects_lookup_server(const struct tracer_objects *objects, uint32_t id)
+{
+    uint32_t index = id - TRACER_SERVER_ID_START;
+
+    if (id >= TRACER_SERVER_ID_START && index < objects->capacity[TRACER_OBJECTS_SERVER])
+        return objects->interfaces[TRACER_OBJECTS_SERVER][index];
+
+    return NULL;
+}
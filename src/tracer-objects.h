@@ -0,0 +1,117 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef TRACER_OBJECTS_H
+#define TRACER_OBJECTS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Object ids allocated by the compositor start there, below are the ids of the client
+#define TRACER_SERVER_ID_START 0xff000000
+// Highest index in each range, as in wl_map
+#define TRACER_OBJECTS_MAX 0x00f00000
+
+// Set in the generation of a destroyed object of the client, until the compositor frees its id
+#define TRACER_OBJECTS_DESTROYED 0x80000000u
+
+#define TRACER_OBJECTS_CLIENT 0
+#define TRACER_OBJECTS_SERVER 1
+
+struct tracer_interface;
+
+// Interfaces of the live objects of an instance, indexed by id in two flat arrays, one for the
+// ids of the client and one for those of the compositor (minus TRACER_SERVER_ID_START). Both sides
+// allocate their ids densely, a new id is at most the count of its range. Every slot has a
+// generation, bumped each time an object is created with its id, which tells apart the objects
+// reusing an id. An object of the client stays in the table once destroyed, flagged in its
+// generation, until wl_display.delete_id: the compositor can send events to it until then.
+// Replaces wl_map, which packs flags in the pointers and keeps a free list the
+// tracer never uses.
+struct tracer_objects
+{
+    struct tracer_interface **interfaces[2];
+    uint32_t *generations[2];
+    uint32_t count[2];          // highest index used plus one
+    uint32_t capacity[2];
+};
+
+void tracer_objects_init(struct tracer_objects *objects);
+void tracer_objects_release(struct tracer_objects *objects);
+int tracer_objects_insert(struct tracer_objects *objects, uint32_t id,
+                          struct tracer_interface *interface);
+struct tracer_interface *tracer_objects_lookup_server(const struct tracer_objects *objects,
+                                                      uint32_t id);
+
+// Interface of an object, NULL if it is unknown. Server ids are above the capacity of the client
+// range, ids of the client only cost one bounds check and one load.
+static inline struct tracer_interface *
+tracer_objects_lookup(const struct tracer_objects *objects, uint32_t id)
+{
+    if (id < objects->capacity[TRACER_OBJECTS_CLIENT])
+        return objects->interfaces[TRACER_OBJECTS_CLIENT][id];
+
+    return tracer_objects_lookup_server(objects, id);
+}
+
+static inline void
+tracer_objects_remove(struct tracer_objects *objects, uint32_t id)
+{
+    int side = id >= TRACER_SERVER_ID_START;
+    uint32_t index = side ? id - TRACER_SERVER_ID_START : id;
+
+    if (index < objects->capacity[side])
+        objects->interfaces[side][index] = NULL;
+}
+
+// Mark an object as destroyed, it can still be looked up
+static inline void
+tracer_objects_destroy(struct tracer_objects *objects, uint32_t id)
+{
+    int side = id >= TRACER_SERVER_ID_START;
+    uint32_t index = side ? id - TRACER_SERVER_ID_START : id;
+
+    if (index < objects->capacity[side])
+        objects->generations[side][index] |= TRACER_OBJECTS_DESTROYED;
+}
+
+// Generation of the object with this id, 0 if none was ever created with it
+static inline uint32_t
+tracer_objects_generation(const struct tracer_objects *objects, uint32_t id)
+{
+    int side = id >= TRACER_SERVER_ID_START;
+    uint32_t index = side ? id - TRACER_SERVER_ID_START : id;
+
+    if (index >= objects->capacity[side])
+        return 0;
+    return objects->generations[side][index] & ~TRACER_OBJECTS_DESTROYED;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,262 @@
+// -*- mode: C; c-basic-offset: 4 -*-
+
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "tracer-queue.h"
+
+/**************************************************************************************************/
+
+#define QUEUE_MIN_SIZE (64 << 10)
+
+#define load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define load_relaxed(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define load_seq(p) __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define store_relaxed(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+#define store_seq(p, v) __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+
+/**************************************************************************************************/
+
+struct tracer_queue *
+tracer_queue_create(size_t size, int policy)
+{
+    struct tracer_queue *queue;
+    uint64_t capacity = QUEUE_MIN_SIZE;
+
+    while (capacity < size)
+        capacity <<= 1;
+
+    queue = calloc(1, sizeof *queue);
+    if (queue == NULL)
+        return NULL;
+
+    queue->data = malloc(capacity);
+    if (queue->data == NULL) {
+        free(queue);
+        errno = ENOMEM;
+        return NULL;
+    }
+    queue->capacity = capacity;
+    queue->policy = policy;
+
+    queue->producer_fd = eventfd(0, EFD_CLOEXEC);
+    queue->consumer_fd = eventfd(0, EFD_CLOEXEC);
+    if (queue->producer_fd < 0 || queue->consumer_fd < 0) {
+        tracer_queue_destroy(queue);
+        return NULL;
+    }
+
+    return queue;
+}
+
+void
+tracer_queue_destroy(struct tracer_queue *queue)
+{
+    if (queue->producer_fd >= 0)
+        close(queue->producer_fd);
+    if (queue->consumer_fd >= 0)
+        close(queue->consumer_fd);
+    free(queue->data);
+    free(queue);
+}
+
+/**************************************************************************************************/
+
+static void
+queue_wake(int fd)
+{
+    uint64_t one = 1;
+
+    while (write(fd, &one, sizeof one) < 0 && errno == EINTR)
+        ;
+}
+
+static void
+queue_sleep(int fd)
+{
+    uint64_t count;
+
+    while (read(fd, &count, sizeof count) < 0 && errno == EINTR)
+        ;
+}
+
+static void
+queue_copy_in(struct tracer_queue *queue, uint64_t pos, const void *data, size_t count)
+{
+    uint64_t offset = pos & (queue->capacity - 1);
+    size_t first = queue->capacity - offset;
+
+    if (first >= count) {
+        memcpy(queue->data + offset, data, count);
+    }
+    else {
+        memcpy(queue->data + offset, data, first);
+        memcpy(queue->data, (const char *) data + first, count - first);
+    }
+}
+
+static void
+queue_copy_out(struct tracer_queue *queue, uint64_t pos, void *data, size_t count)
+{
+    uint64_t offset = pos & (queue->capacity - 1);
+    size_t first = queue->capacity - offset;
+
+    if (first >= count) {
+        memcpy(data, queue->data + offset, count);
+    }
+    else {
+        memcpy(data, queue->data + offset, first);
+        memcpy((char *) data + first, queue->data, count - first);
+    }
+}
+
+/**************************************************************************************************/
+
+// Producer: reserve room for a record of size bytes, written with tracer_queue_append() and
+// published by tracer_queue_end(). Return -1 if the record is dropped, the appends are then
+// ignored.
+int
+tracer_queue_begin(struct tracer_queue *queue, uint32_t size)
+{
+    uint64_t head = queue->head;
+    uint64_t need = sizeof size + (uint64_t) size;
+
+    queue->skip = 1;
+    if (need > queue->capacity) {
+        store_relaxed(&queue->dropped, queue->dropped + 1);
+        return -1;
+    }
+
+    while (queue->capacity - (head - load_acquire(&queue->tail)) < need) {
+        if (queue->policy == TRACER_QUEUE_DROP) {
+            store_relaxed(&queue->dropped, queue->dropped + 1);
+            return -1;
+        }
+
+        store_seq(&queue->producer_waiting, 1);
+        if (queue->capacity - (head - load_seq(&queue->tail)) < need)
+            queue_sleep(queue->producer_fd);
+        store_relaxed(&queue->producer_waiting, 0);
+    }
+
+    queue->skip = 0;
+    queue_copy_in(queue, head, &size, sizeof size);
+    queue->write_pos = head + sizeof size;
+
+    return 0;
+}
+
+void
+tracer_queue_append(struct tracer_queue *queue, const void *data, size_t count)
+{
+    if (queue->skip)
+        return;
+
+    queue_copy_in(queue, queue->write_pos, data, count);
+    queue->write_pos += count;
+}
+
+void
+tracer_queue_end(struct tracer_queue *queue)
+{
+    if (queue->skip)
+        return;
+
+    store_seq(&queue->head, queue->write_pos);
+    if (load_seq(&queue->consumer_waiting))
+        queue_wake(queue->consumer_fd);
+}
+
+// Producer: no more records, the consumer returns once the queue is drained
+void
+tracer_queue_close(struct tracer_queue *queue)
+{
+    store_seq(&queue->closed, 1);
+    queue_wake(queue->consumer_fd);
+}
+
+/**************************************************************************************************/
+
+// Consumer: copy the oldest record into *buf, grown as needed, and return its size, 0 if the queue
+// is empty. Records are never empty.
+uint32_t
+tracer_queue_pop(struct tracer_queue *queue, char **buf, size_t *capacity)
+{
+    uint64_t tail = load_relaxed(&queue->tail);
+    uint32_t size;
+
+    if (load_acquire(&queue->head) == tail)
+        return 0;
+
+    queue_copy_out(queue, tail, &size, sizeof size);
+    if (size > *capacity) {
+        char *data = realloc(*buf, size);
+        if (data != NULL) {
+            *buf = data;
+            *capacity = size;
+        }
+    }
+    if (size <= *capacity)
+        queue_copy_out(queue, tail + sizeof size, *buf, size);
+
+    store_seq(&queue->tail, tail + sizeof size + size);
+    if (load_seq(&queue->producer_waiting))
+        queue_wake(queue->producer_fd);
+
+    // a record that does not fit in memory is lost
+    return size <= *capacity ? size : 0;
+}
+
+// Consumer: sleep until a record is available, return 0 once the queue is closed and drained
+int
+tracer_queue_wait(struct tracer_queue *queue)
+{
+    uint64_t tail = load_relaxed(&queue->tail);
+
+    for (;;) {
+        store_seq(&queue->consumer_waiting, 1);
+        if (load_seq(&queue->head) != tail)
+            break;
+        // the last records are published before the queue is closed
+        if (load_seq(&queue->closed)) {
+            store_relaxed(&queue->consumer_waiting, 0);
+            return load_seq(&queue->head) != tail;
+        }
+        queue_sleep(queue->consumer_fd);
+    }
+    store_relaxed(&queue->consumer_waiting, 0);
+
+    return 1;
+}
+
+uint64_t
+tracer_queue_dropped(struct tracer_queue *queue)
+{
+    return load_relaxed(&queue->dropped);
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef TRACER_QUEUE_H
+#define TRACER_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define TRACER_QUEUE_DEFAULT_SIZE (16 << 20)
+
+// What the producer does when a record does not fit in the queue
+#define TRACER_QUEUE_DROP 0
+#define TRACER_QUEUE_BLOCK 1
+
+// Single-producer single-consumer queue of variable-size records, without locks. The forwarding
+// thread pushes the raw records, the writer thread pops them and does the formatting.
+//
+// A record is a uint32_t size followed by the data, in a power-of-two byte ring; head and tail
+// grow without wrapping. Each side only writes its own position and publishes it with a release
+// store, the other side reads it with an acquire load. A side about to sleep sets its waiting
+// flag then checks the other position again, the other side checks the flag after moving its own
+// position (both sequentially consistent): the eventfd is only written when someone sleeps, so
+// an uncontended push does not make any system call.
+struct tracer_queue
+{
+    char *data;
+    uint64_t capacity;
+    int policy;
+
+    // producer side
+    uint64_t head;              // published
+    uint64_t write_pos;         // end of the record being written
+    int skip;                   // the record being written is dropped
+    int producer_waiting;
+    int producer_fd;
+    uint64_t dropped;           // records dropped, read by the consumer
+    int closed;
+    char producer_padding[64];
+
+    // consumer side
+    uint64_t tail;              // published
+    int consumer_waiting;
+    int consumer_fd;
+};
+
+struct tracer_queue *tracer_queue_create(size_t size, int policy);
+void tracer_queue_destroy(struct tracer_queue *queue);
+
+int tracer_queue_begin(struct tracer_queue *queue, uint32_t size);
+void tracer_queue_append(struct tracer_queue *queue, const void *data, size_t count);
+void tracer_queue_end(struct tracer_queue *queue);
+void tracer_queue_close(struct tracer_queue *queue);
+
+uint32_t tracer_queue_pop(struct tracer_queue *queue, char **buf, size_t *capacity);
+int tracer_queue_wait(struct tracer_queue *queue);
+uint64_t tracer_queue_dropped(struct tracer_queue *queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,212 @@
+// -*- mode: C; c-basic-offset: 4 -*-
+
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "wayland-private.h"
+#include "tracer.h"
+#include "tracer-analyzer.h"
+#include "tracer-filter.h"
+#include "tracer-record.h"
+#include "frontend-analyze.h"
+
+/**************************************************************************************************/
+
+// Instances are created on their first record, with the same initial objects as a live one
+static struct tracer_instance *
+decode_get_instance(struct tracer *tracer, int id)
+{
+    struct tracer_analyzer *analyzer = (struct tracer_analyzer *) tracer->frontend_data;
+    struct tracer_instance *instance;
+
+    wl_list_for_each(instance, &tracer->instance_list, link) {
+        if (instance->id == id)
+            return instance;
+    }
+
+    instance = calloc(1, sizeof *instance);
+    if (instance == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    instance->id = id;
+    instance->tracer = tracer;
+    tracer_objects_init(&instance->objects);
+    tracer_objects_insert(&instance->objects, 0, NULL);
+    tracer_objects_insert(&instance->objects, 1, analyzer->display_interface);
+    if (tracer->filter != NULL)
+        instance->filter_bits = tracer_filter_get(tracer->filter, id);
+    wl_list_insert(&tracer->instance_list, &instance->link);
+
+    return instance;
+}
+
+static void
+decode_record(struct tracer_instance *instance, struct tracer_record_header *header,
+              const char *data)
+{
+    const int32_t *fds = (const int32_t *) (data + header->data_size);
+    int fd_count = header->fd_count;
+    uint32_t offset, size;
+
+    for (offset = 0; header->data_size - offset >= 2 * sizeof(uint32_t); offset += size) {
+        size = ((const uint32_t *) (data + offset))[1] >> 16;
+        if (size < 2 * sizeof(uint32_t) || size > header->data_size - offset) {
+            fprintf(stderr, "Invalid message size %u in record of instance %u\n",
+                    size, header->instance);
+            return;
+        }
+        int used = analyze_message(instance, header->side, data + offset, size, fds, fd_count);
+        fds += used;
+        fd_count -= used;
+    }
+}
+
+static void
+decode_release_instance(struct tracer *tracer, int id, uint64_t time)
+{
+    struct tracer_instance *instance;
+
+    wl_list_for_each(instance, &tracer->instance_list, link) {
+        if (instance->id == id) {
+            instance->time = time;
+            analyze_report_leaks(instance);
+            wl_list_remove(&instance->link);
+            tracer_objects_release(&instance->objects);
+            if (instance->filter_bits != NULL)
+                tracer_filter_put(tracer->filter, instance->filter_bits);
+            free(instance);
+            return;
+        }
+    }
+}
+
+// Render a record, header included, as if its messages were received live
+int
+tracer_record_decode_one(struct tracer *tracer, const char *record, uint32_t size)
+{
+    struct tracer_record_header header;
+    struct tracer_instance *instance;
+
+    if (size < sizeof header)
+        return -1;
+    memcpy(&header, record, sizeof header);
+    if (header.size != size ||
+        size - sizeof header != header.data_size + header.fd_count * sizeof(int32_t))
+        return -1;
+
+    if (header.data_size == 0 && header.fd_count == 0) {
+        decode_release_instance(tracer, header.instance, header.time);
+        return 0;
+    }
+
+    instance = decode_get_instance(tracer, header.instance);
+    if (instance == NULL)
+        return -1;
+
+    instance->time = header.time;
+    decode_record(instance, &header, record + sizeof header);
+
+    return 0;
+}
+
+// Render a binary trace through the analyzer
+int
+tracer_record_decode(struct tracer *tracer, const char *filename)
+{
+    struct tracer_record_file_header file_header;
+    struct tracer_record_header header;
+    char *record = NULL;
+    size_t capacity = 0;
+    int rc = -1;
+    FILE *fp;
+
+    fp = fopen(filename, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Unable to open trace file %s: %m\n", filename);
+        return -1;
+    }
+
+    // the header of version 1 ends before realtime_offset
+    memset(&file_header, 0, sizeof file_header);
+    if (fread(&file_header, offsetof(struct tracer_record_file_header, realtime_offset), 1,
+              fp) != 1 ||
+        memcmp(file_header.magic, TRACER_RECORD_MAGIC, sizeof TRACER_RECORD_MAGIC) != 0) {
+        fprintf(stderr, "%s is not a wayland-tracer binary trace\n", filename);
+        goto out;
+    }
+    if (file_header.version != 1 && file_header.version != TRACER_RECORD_VERSION) {
+        fprintf(stderr, "Unsupported trace version %u\n", file_header.version);
+        goto out;
+    }
+    if (file_header.version >= 2 &&
+        fread(&file_header.realtime_offset, sizeof file_header.realtime_offset, 1, fp) != 1) {
+        fprintf(stderr, "Truncated header in %s\n", filename);
+        goto out;
+    }
+
+    // instance ids are only printed in server mode, timestamps in wall-clock time when known
+    tracer->options->mode = file_header.mode;
+    tracer->time_offset = file_header.realtime_offset;
+
+    while (fread(&header, sizeof header, 1, fp) == 1) {
+        if (header.size < sizeof header) {
+            fprintf(stderr, "Corrupted record in %s\n", filename);
+            goto out;
+        }
+
+        if (header.size > capacity) {
+            free(record);
+            record = malloc(header.size);
+            if (record == NULL) {
+                fprintf(stderr, "Failed to alloc record: %m\n");
+                goto out;
+            }
+            capacity = header.size;
+        }
+        memcpy(record, &header, sizeof header);
+        if (fread(record + sizeof header, 1, header.size - sizeof header, fp) !=
+            header.size - sizeof header) {
+            fprintf(stderr, "Truncated record in %s\n", filename);
+            goto out;
+        }
+
+        if (tracer_record_decode_one(tracer, record, header.size) < 0) {
+            fprintf(stderr, "Corrupted record in %s\n", filename);
+            goto out;
+        }
+    }
+
+    rc = 0;
+
+  out:
+    free(record);
+    fclose(fp);
+    return rc;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef TRACER_RECORD_H
+#define TRACER_RECORD_H
+
+#include <stdint.h>
+
+#include "tracer.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Binary trace file format
+//
+// The file starts with a tracer_record_file_header, followed by records. A record holds the
+// complete messages received at once on a connection, as they were on the wire, followed by the
+// numbers of the fds which came along. A record without data nor fds marks the end of an
+// instance. Version 1 files have no realtime_offset in their header.
+
+#define TRACER_RECORD_MAGIC "WLTRACE"
+#define TRACER_RECORD_VERSION 2
+
+struct tracer_record_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t mode;
+    int64_t realtime_offset;    // CLOCK_REALTIME minus the timestamps of the records, in ns
+};
+
+struct tracer_record_header
+{
+    uint32_t size;              // record size, header included
+    uint32_t instance;          // instance id
+    uint64_t time;              // tracer_monotonic_time() of the read, in ns
+    uint16_t side;              // side of the sender
+    uint16_t fd_count;          // number of int32_t fds after the wire data
+    uint32_t data_size;         // size of the wire data
+};
+
+int tracer_record_decode_one(struct tracer *tracer, const char *record, uint32_t size);
+int tracer_record_decode(struct tracer *tracer, const char *filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,352 @@
+// -*- mode: C; c-basic-offset: 4 -*-
+
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "wayland-private.h"
+#include "tracer-record.h"
+#include "tracer-recorder.h"
+
+/**************************************************************************************************/
+
+// The data area starts on its own cache line
+#define RECORDER_DATA_OFFSET 64
+
+// head and tail are read by the dump thread
+#define load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define load_relaxed(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define store_relaxed(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+
+struct tracer_recorder *
+tracer_recorder_create(const char *path, size_t size, int mode, int64_t time_offset,
+                       int dump_keep)
+{
+    struct tracer_recorder *recorder;
+    void *map;
+    int fd;
+
+    recorder = calloc(1, sizeof *recorder);
+    if (recorder == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        goto err_open;
+
+    recorder->map_size = RECORDER_DATA_OFFSET + size;
+    if (ftruncate(fd, recorder->map_size) < 0)
+        goto err_map;
+
+    map = mmap(NULL, recorder->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        goto err_map;
+    close(fd);
+
+    recorder->path = path;
+    recorder->time_offset = time_offset;
+    recorder->dump_keep = dump_keep;
+    pthread_mutex_init(&recorder->lock, NULL);
+    pthread_cond_init(&recorder->cond, NULL);
+    recorder->header = map;
+    recorder->data = (char *) map + RECORDER_DATA_OFFSET;
+
+    memcpy(recorder->header->magic, TRACER_RECORDER_MAGIC, sizeof TRACER_RECORDER_MAGIC);
+    recorder->header->version = TRACER_RECORDER_VERSION;
+    recorder->header->mode = mode;
+    recorder->header->size = size;
+
+    return recorder;
+
+  err_map:
+    close(fd);
+  err_open:
+    free(recorder);
+    return NULL;
+}
+
+// Waits for the requested dumps to be written
+void
+tracer_recorder_destroy(struct tracer_recorder *recorder)
+{
+    if (recorder->started) {
+        pthread_mutex_lock(&recorder->lock);
+        recorder->closing = 1;
+        pthread_cond_signal(&recorder->cond);
+        pthread_mutex_unlock(&recorder->lock);
+        pthread_join(recorder->thread, NULL);
+    }
+
+    pthread_cond_destroy(&recorder->cond);
+    pthread_mutex_destroy(&recorder->lock);
+    munmap(recorder->header, recorder->map_size);
+    free(recorder);
+}
+
+/**************************************************************************************************/
+
+static void
+recorder_copy_out(struct tracer_recorder *recorder, uint64_t position, void *data, size_t count)
+{
+    uint64_t size = recorder->header->size;
+    size_t offset = position % size;
+
+    if (offset + count <= size) {
+        memcpy(data, recorder->data + offset, count);
+    }
+    else {
+        memcpy(data, recorder->data + offset, size - offset);
+        memcpy((char *) data + (size - offset), recorder->data, count - (size - offset));
+    }
+}
+
+// Make room for a record of size bytes, evicting the oldest records
+void
+tracer_recorder_begin(struct tracer_recorder *recorder, uint32_t size)
+{
+    struct tracer_recorder_header *header = recorder->header;
+    uint64_t tail = header->tail;
+    uint32_t record_size;
+
+    // rejected by the option parsing, see wl_connection_max_input_size()
+    if (size > header->size) {
+        header->dropped++;
+        recorder->skip = 1;
+        fprintf(stderr, "Flight recorder dropped a record of %u bytes, larger than the recorder\n",
+                size);
+        return;
+    }
+
+    if (header->head + size - tail > header->size) {
+        while (header->head + size - tail > header->size) {
+            recorder_copy_out(recorder, tail, &record_size, sizeof record_size);
+            tail += record_size;
+        }
+        // the dump thread sees the new tail before the evicted records are overwritten
+        store_relaxed(&header->tail, tail);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    recorder->skip = 0;
+    recorder->position = header->head;
+}
+
+void
+tracer_recorder_append(struct tracer_recorder *recorder, const void *data, size_t count)
+{
+    uint64_t size = recorder->header->size;
+    size_t offset = recorder->position % size;
+
+    if (recorder->skip)
+        return;
+
+    if (offset + count <= size) {
+        memcpy(recorder->data + offset, data, count);
+    }
+    else {
+        memcpy(recorder->data + offset, data, size - offset);
+        memcpy(recorder->data, (const char *) data + (size - offset), count - (size - offset));
+    }
+    recorder->position += count;
+}
+
+// Publish the record
+void
+tracer_recorder_end(struct tracer_recorder *recorder)
+{
+    if (!recorder->skip)
+        store_release(&recorder->header->head, recorder->position);
+}
+
+/**************************************************************************************************/
+
+static void
+recorder_write_out(struct tracer_recorder *recorder, FILE *fp, uint64_t position, size_t count)
+{
+    uint64_t size = recorder->header->size;
+    size_t offset = position % size;
+
+    if (offset + count <= size) {
+        fwrite(recorder->data + offset, 1, count, fp);
+    }
+    else {
+        fwrite(recorder->data + offset, 1, size - offset, fp);
+        fwrite(recorder->data, 1, count - (size - offset), fp);
+    }
+}
+
+// Write the records from tail to head as the binary trace path, while the forwarding thread
+// evicts them: a record overwritten before it was written out is taken back, the dump goes on
+// from the new tail. Returns the number of bytes written, -1 on error.
+static int64_t
+recorder_write_dump(struct tracer_recorder *recorder, const char *path, uint64_t *lost)
+{
+    struct tracer_recorder_header *header = recorder->header;
+    struct tracer_record_file_header file_header;
+    uint64_t head, position, tail;
+    uint32_t record_size;
+    off_t written;
+    FILE *fp;
+
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open dump file %s: %m\n", path);
+        return -1;
+    }
+
+    memset(&file_header, 0, sizeof file_header);
+    memcpy(file_header.magic, TRACER_RECORD_MAGIC, sizeof TRACER_RECORD_MAGIC);
+    file_header.version = TRACER_RECORD_VERSION;
+    file_header.mode = header->mode;
+    file_header.realtime_offset = recorder->time_offset;
+    fwrite(&file_header, sizeof file_header, 1, fp);
+    written = sizeof file_header;
+
+    *lost = 0;
+    head = load_acquire(&header->head);
+    position = load_relaxed(&header->tail);
+    while (position < head) {
+        recorder_copy_out(recorder, position, &record_size, sizeof record_size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        tail = load_relaxed(&header->tail);
+        if (tail <= position) {
+            if (record_size < sizeof(struct tracer_record_header) || record_size > head - position)
+                break;
+            recorder_write_out(recorder, fp, position, record_size);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            tail = load_relaxed(&header->tail);
+            if (tail <= position) {
+                written += record_size;
+                position += record_size;
+                continue;
+            }
+            // overwritten while it was copied to the file
+            if (fflush(fp) != 0 || ftruncate(fileno(fp), written) < 0 ||
+                fseeko(fp, written, SEEK_SET) < 0)
+                break;
+        }
+        *lost += (tail < head ? tail : head) - position;
+        position = tail;
+    }
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Failed to write dump file %s: %m\n", path);
+        return -1;
+    }
+
+    return written - (off_t) sizeof file_header;
+}
+
+static void *
+recorder_run(void *data)
+{
+    struct tracer_recorder *recorder = data;
+    char reason[sizeof recorder->reason];
+    char path[4096];
+    int64_t count;
+    uint64_t lost;
+    int merged;
+
+    pthread_mutex_lock(&recorder->lock);
+    for (;;) {
+        while (!recorder->requested && !recorder->closing)
+            pthread_cond_wait(&recorder->cond, &recorder->lock);
+        if (!recorder->requested)
+            break;
+        memcpy(reason, recorder->reason, sizeof reason);
+        merged = recorder->merged;
+        recorder->requested = 0;
+        recorder->merged = 0;
+        pthread_mutex_unlock(&recorder->lock);
+
+        snprintf(path, sizeof path, "%s.%d.wlt", recorder->path, recorder->dump_count);
+        count = recorder_write_dump(recorder, path, &lost);
+        if (count >= 0) {
+            fprintf(stderr, "Flight recorder dumped to %s (%s", path, reason);
+            if (merged > 0)
+                fprintf(stderr, " and %d more", merged);
+            fprintf(stderr, "), %" PRId64 " bytes", count);
+            if (lost > 0)
+                fprintf(stderr, ", %" PRIu64 " bytes overwritten before they were written", lost);
+            fprintf(stderr, "\n");
+
+            // only the latest dumps are kept
+            if (recorder->dump_keep > 0 && recorder->dump_count >= recorder->dump_keep) {
+                snprintf(path, sizeof path, "%s.%d.wlt", recorder->path,
+                         recorder->dump_count - recorder->dump_keep);
+                if (unlink(path) < 0 && errno != ENOENT)
+                    fprintf(stderr, "Failed to remove dump file %s: %m\n", path);
+            }
+            recorder->dump_count++;
+        }
+
+        pthread_mutex_lock(&recorder->lock);
+    }
+    pthread_mutex_unlock(&recorder->lock);
+
+    return NULL;
+}
+
+// Ask the dump thread to write the recorded messages as a binary trace named after the recorder
+// file; requests made while it is busy are merged into the next dump. Must be called once signals
+// are blocked, the thread inherits the mask.
+int
+tracer_recorder_dump(struct tracer_recorder *recorder, const char *reason)
+{
+    pthread_mutex_lock(&recorder->lock);
+
+    if (!recorder->started) {
+        errno = pthread_create(&recorder->thread, NULL, recorder_run, recorder);
+        if (errno != 0) {
+            pthread_mutex_unlock(&recorder->lock);
+            fprintf(stderr, "Failed to start the flight recorder dump thread: %m\n");
+            return -1;
+        }
+        recorder->started = 1;
+    }
+
+    if (recorder->requested) {
+        recorder->merged++;
+    }
+    else {
+        snprintf(recorder->reason, sizeof recorder->reason, "%s", reason);
+        recorder->requested = 1;
+        pthread_cond_signal(&recorder->cond);
+    }
+
+    pthread_mutex_unlock(&recorder->lock);
+
+    return 0;
+}
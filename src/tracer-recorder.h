@@ -0,0 +1,101 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef TRACER_RECORDER_H
+#define TRACER_RECORDER_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Default size of the flight recorder file
+#define TRACER_RECORDER_DEFAULT_SIZE (64 << 20)
+// Default number of dump files kept
+#define TRACER_RECORDER_DEFAULT_DUMPS 8
+#define TRACER_RECORDER_MAX_DUMPS 10000
+
+#define TRACER_RECORDER_MAGIC "WLTRING"
+#define TRACER_RECORDER_VERSION 1
+
+// The flight recorder keeps the most recent binary records (see tracer-record.h) in a fixed-size
+// circular file mapped in memory. Writing a record only stores to the mapping, the oldest records
+// are evicted to make room. The content is dumped as a regular binary trace on request, by a
+// thread of its own, while the records keep coming.
+//
+// Positions are byte counts since the creation of the file, the offset in the data area is the
+// position modulo its size. tail is always on a record boundary, it moves before the records it
+// evicts are overwritten: a record the dump thread read is intact if tail did not pass it.
+struct tracer_recorder_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t mode;
+    uint64_t size;              // size of the data area
+    uint64_t head;              // position of the next record
+    uint64_t tail;              // position of the oldest record
+    uint64_t dropped;           // records larger than the data area
+};
+
+struct tracer_recorder
+{
+    const char *path;
+    struct tracer_recorder_header *header;
+    char *data;
+    size_t map_size;
+    uint64_t position;
+    int skip;
+    // realtime offset of the run, written to the header of the dumps
+    int64_t time_offset;
+
+    // the dump thread, started by the first dump; requests made before it takes one are merged
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int started;
+    int closing;
+    int requested;
+    int merged;
+    char reason[64];
+    int dump_count;
+    int dump_keep;              // dump files kept, 0 for all
+};
+
+struct tracer_recorder *tracer_recorder_create(const char *path, size_t size, int mode,
+                                               int64_t time_offset, int dump_keep);
+void tracer_recorder_destroy(struct tracer_recorder *recorder);
+
+void tracer_recorder_begin(struct tracer_recorder *recorder, uint32_t size);
+void tracer_recorder_append(struct tracer_recorder *recorder, const void *data, size_t count);
+void tracer_recorder_end(struct tracer_recorder *recorder);
+
+int tracer_recorder_dump(struct tracer_recorder *recorder, const char *reason);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,311 @@
+// -*- mode: C; c-basic-offset: 4 -*-
+
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "wayland-private.h"
+#include "tracer.h"
+#include "tracer-analyzer.h"
+#include "tracer-clock.h"
+#include "tracer-stats.h"
+#include "tracer-writer.h"
+
+/**************************************************************************************************/
+
+struct stats_entry
+{
+    int instance;
+    uint32_t slot;              // or type_index in the interface table
+    struct tracer_stats_counter counter;
+};
+
+struct tracer_stats *
+tracer_stats_create(struct tracer_analyzer *analyzer, int top)
+{
+    struct tracer_interface **interfaces = analyzer->interfaces;
+    struct itimerspec its;
+    struct tracer_stats *stats;
+    uint32_t slot;
+    int i, count;
+
+    stats = calloc(1, sizeof *stats);
+    if (stats == NULL)
+        return NULL;
+
+    for (count = 0; interfaces[count] != NULL; count++)
+        ;
+
+    stats->analyzer = analyzer;
+    stats->top = top;
+    stats->base = malloc((count + 1) * sizeof *stats->base);
+    if (stats->base == NULL)
+        goto err;
+
+    for (i = 0; i < count; i++) {
+        stats->base[i] = stats->slot_count;
+        stats->slot_count += interfaces[i]->method_count + interfaces[i]->event_count;
+    }
+
+    stats->slot_type = malloc((stats->slot_count + 1) * sizeof *stats->slot_type);
+    stats->interval = calloc(stats->slot_count + 1, sizeof *stats->interval);
+    if (stats->slot_type == NULL || stats->interval == NULL)
+        goto err;
+
+    for (i = 0; i < count; i++) {
+        for (slot = stats->base[i]; slot < stats->base[i] + interfaces[i]->method_count +
+             interfaces[i]->event_count; slot++)
+            stats->slot_type[slot] = i;
+    }
+
+    stats->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (stats->timerfd < 0)
+        goto err;
+
+    its.it_value.tv_sec = TRACER_STATS_INTERVAL_MS / 1000;
+    its.it_value.tv_nsec = (TRACER_STATS_INTERVAL_MS % 1000) * 1000000L;
+    its.it_interval = its.it_value;
+    if (timerfd_settime(stats->timerfd, 0, &its, NULL) < 0) {
+        close(stats->timerfd);
+        goto err;
+    }
+
+    stats->last_report = tracer_monotonic_time();
+
+    return stats;
+
+  err:
+    free(stats->base);
+    free(stats->slot_type);
+    free(stats->interval);
+    free(stats);
+    errno = ENOMEM;
+    return NULL;
+}
+
+struct tracer_stats_counter *
+tracer_stats_instance_create(struct tracer_stats *stats)
+{
+    return calloc(stats->slot_count + 1, sizeof(struct tracer_stats_counter));
+}
+
+// The counters of the instance are still reported once, a client which comes and goes between two
+// reports is not missed
+void
+tracer_stats_instance_destroy(struct tracer_stats *stats, int instance,
+                              struct tracer_stats_counter *counters)
+{
+    if (stats->retired_count == stats->retired_capacity) {
+        int capacity = stats->retired_capacity == 0 ? 16 : stats->retired_capacity * 2;
+        struct tracer_stats_retired *retired;
+
+        retired = realloc(stats->retired, capacity * sizeof *retired);
+        if (retired == NULL) {
+            free(counters);
+            return;
+        }
+        stats->retired = retired;
+        stats->retired_capacity = capacity;
+    }
+
+    stats->retired[stats->retired_count].instance = instance;
+    stats->retired[stats->retired_count].counters = counters;
+    stats->retired_count++;
+}
+
+/**************************************************************************************************/
+
+// Keep the entries with the most messages, in decreasing order
+static void
+stats_insert(struct stats_entry *top, int *count, int max, const struct stats_entry *entry)
+{
+    int i;
+
+    if (*count < max) {
+        i = (*count)++;
+    }
+    else {
+        if (entry->counter.messages <= top[max - 1].counter.messages)
+            return;
+        i = max - 1;
+    }
+
+    while (i > 0 && top[i - 1].counter.messages < entry->counter.messages) {
+        top[i] = top[i - 1];
+        i--;
+    }
+    top[i] = *entry;
+}
+
+// Add the counters of an instance to the top entries, and reset them
+static void
+stats_collect(struct tracer_stats *stats, struct stats_entry *top, int *count, int instance,
+              struct tracer_stats_counter *counters)
+{
+    struct stats_entry entry;
+    uint32_t slot;
+
+    for (slot = 0; slot < stats->slot_count; slot++) {
+        if (counters[slot].messages == 0)
+            continue;
+        entry.instance = instance;
+        entry.slot = slot;
+        entry.counter = counters[slot];
+        stats_insert(top, count, stats->top, &entry);
+    }
+    memset(counters, 0, stats->slot_count * sizeof *counters);
+}
+
+static uint64_t
+stats_rate(uint64_t value, uint64_t elapsed)
+{
+    return (uint64_t) ((double) value * 1000000000.0 / elapsed);
+}
+
+static void
+stats_print_counter(struct tracer *tracer, const struct tracer_stats_counter *counter,
+                    uint64_t elapsed)
+{
+    tracer_print(tracer, "%10llu %12llu %8llu",
+                 (unsigned long long) stats_rate(counter->messages, elapsed),
+                 (unsigned long long) stats_rate(counter->bytes, elapsed),
+                 (unsigned long long) stats_rate(counter->fds, elapsed));
+}
+
+static void
+stats_print_slot(struct tracer *tracer, struct tracer_stats *stats, uint32_t slot)
+{
+    uint32_t type = stats->slot_type[slot];
+    struct tracer_interface *interface = stats->analyzer->interfaces[type];
+    uint32_t index = slot - stats->base[type];
+
+    if (index < (uint32_t) interface->method_count)
+        tracer_print(tracer, "<- %s.%s\n", interface->name, interface->methods[index]->name);
+    else
+        tracer_print(tracer, "-> %s.%s\n", interface->name,
+                     interface->events[index - interface->method_count]->name);
+}
+
+// Print the busiest messages of the instances and the busiest interfaces since the last report,
+// then start a new interval
+void
+tracer_stats_report(struct tracer *tracer)
+{
+    struct tracer_stats *stats = tracer->stats;
+    struct tracer_interface **interfaces = stats->analyzer->interfaces;
+    struct stats_entry top[stats->top], entry;
+    struct tracer_stats_counter sum, *per_interface;
+    struct tracer_instance *instance;
+    uint64_t now = tracer_monotonic_time();
+    uint64_t elapsed = now > stats->last_report ? now - stats->last_report : 1;
+    int count, interface_count, i;
+    uint32_t slot;
+
+    for (interface_count = 0; interfaces[interface_count] != NULL; interface_count++)
+        ;
+    per_interface = calloc(interface_count + 1, sizeof *per_interface);
+    if (per_interface == NULL)
+        return;
+
+    memset(&sum, 0, sizeof sum);
+    for (slot = 0; slot < stats->slot_count; slot++) {
+        struct tracer_stats_counter *c = &stats->interval[slot];
+        struct tracer_stats_counter *t = &per_interface[stats->slot_type[slot]];
+        t->messages += c->messages;
+        t->bytes += c->bytes;
+        t->fds += c->fds;
+        sum.messages += c->messages;
+        sum.bytes += c->bytes;
+        sum.fds += c->fds;
+    }
+    stats->total.messages += sum.messages;
+    stats->total.bytes += sum.bytes;
+    stats->total.fds += sum.fds;
+
+    tracer_print(tracer, "==== %.3f s: ", elapsed / 1e9);
+    stats_print_counter(tracer, &sum, elapsed);
+    tracer_print(tracer, " per second, %llu unknown; total %llu messages, %llu bytes, %llu fds\n",
+                 (unsigned long long) stats->unknown,
+                 (unsigned long long) stats->total.messages,
+                 (unsigned long long) stats->total.bytes,
+                 (unsigned long long) stats->total.fds);
+
+    count = 0;
+    wl_list_for_each(instance, &tracer->instance_list, link) {
+        if (instance->stats != NULL)
+            stats_collect(stats, top, &count, instance->id, instance->stats);
+    }
+    for (i = 0; i < stats->retired_count; i++) {
+        stats_collect(stats, top, &count, stats->retired[i].instance, stats->retired[i].counters);
+        free(stats->retired[i].counters);
+    }
+    stats->retired_count = 0;
+
+    tracer_print(tracer, "     msg/s          B/s     fd/s instance message\n");
+    for (i = 0; i < count; i++) {
+        stats_print_counter(tracer, &top[i].counter, elapsed);
+        tracer_print(tracer, " %8d ", top[i].instance);
+        stats_print_slot(tracer, stats, top[i].slot);
+    }
+
+    count = 0;
+    for (i = 0; i < interface_count; i++) {
+        if (per_interface[i].messages == 0)
+            continue;
+        entry.instance = -1;
+        entry.slot = i;
+        entry.counter = per_interface[i];
+        stats_insert(top, &count, stats->top, &entry);
+    }
+
+    tracer_print(tracer, "     msg/s          B/s     fd/s interface\n");
+    for (i = 0; i < count; i++) {
+        stats_print_counter(tracer, &top[i].counter, elapsed);
+        tracer_print(tracer, " %s\n", interfaces[top[i].slot]->name);
+    }
+    tracer_print(tracer, "\n");
+    tracer_writer_flush(tracer->writer);
+
+    free(per_interface);
+    memset(stats->interval, 0, stats->slot_count * sizeof *stats->interval);
+    stats->unknown = 0;
+    stats->last_report = now;
+}
+
+// Called when the timer fd is readable
+void
+tracer_stats_handle_timer(struct tracer *tracer)
+{
+    uint64_t expirations;
+
+    if (read(tracer->stats->timerfd, &expirations, sizeof expirations) < 0 && errno != EAGAIN)
+        return;
+
+    tracer_stats_report(tracer);
+}
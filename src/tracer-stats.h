@@ -0,0 +1,102 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef TRACER_STATS_H
+#define TRACER_STATS_H
+
+#include <stdint.h>
+
+#include "tracer.h"
+#include "tracer-analyzer.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Interval between two reports
+#define TRACER_STATS_INTERVAL_MS 1000
+// Default number of rows of the reports
+#define TRACER_STATS_DEFAULT_TOP 10
+
+struct tracer_stats_counter
+{
+    uint64_t messages;
+    uint64_t bytes;
+    uint64_t fds;
+};
+
+// Counters of an instance destroyed since the last report
+struct tracer_stats_retired
+{
+    int instance;
+    struct tracer_stats_counter *counters;
+};
+
+// Message counters for --stats. Counters are flat arrays with one slot per message, the messages
+// of an interface start at the slot base[type_index], requests then events. Each instance has its
+// own array, the interval array sums all the instances; both are reset by every report.
+struct tracer_stats
+{
+    struct tracer_analyzer *analyzer;
+    uint32_t *base;
+    uint32_t *slot_type;        // type_index of each slot
+    uint32_t slot_count;
+    int top;
+    int timerfd;
+    uint64_t last_report;       // CLOCK_MONOTONIC, in ns
+    struct tracer_stats_counter *interval;
+    struct tracer_stats_counter total;
+    uint64_t unknown;           // messages to unknown objects since the last report
+    struct tracer_stats_retired *retired;
+    int retired_count, retired_capacity;
+};
+
+struct tracer_stats *tracer_stats_create(struct tracer_analyzer *analyzer, int top);
+struct tracer_stats_counter *tracer_stats_instance_create(struct tracer_stats *stats);
+void tracer_stats_instance_destroy(struct tracer_stats *stats, int instance,
+                                   struct tracer_stats_counter *counters);
+
+void tracer_stats_report(struct tracer *tracer);
+void tracer_stats_handle_timer(struct tracer *tracer);
+
+static inline void
+tracer_stats_count(struct tracer_stats *stats, struct tracer_stats_counter *counters,
+                   const struct tracer_interface *interface, int side, int opcode,
+                   uint32_t size, uint32_t fds)
+{
+    uint32_t slot = stats->base[interface->type_index] + opcode +
+        (side == TRACER_CLIENT_SIDE ? 0 : interface->method_count);
+
+    counters[slot].messages++;
+    counters[slot].bytes += size;
+    counters[slot].fds += fds;
+    stats->interval[slot].messages++;
+    stats->interval[slot].bytes += size;
+    stats->interval[slot].fds += fds;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
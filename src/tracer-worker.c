@@ -0,0 +1,496 @@
+// -*- mode: C; c-basic-offset: 4 -*-
+
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wayland-private.h"
+#include "tracer.h"
+#include "tracer-clock.h"
+#include "tracer-recorder.h"
+#include "tracer-worker.h"
+#include "tracer-writer.h"
+
+/**************************************************************************************************/
+
+#define STREAM_INITIAL_CAPACITY (64 << 10)
+#define STREAM_NO_ENTRY ((size_t) -1)
+
+static void
+stream_init(struct tracer_stream *stream)
+{
+    stream->data = NULL;
+    stream->size = 0;
+    stream->capacity = 0;
+    stream->pos = 0;
+    stream->entry = STREAM_NO_ENTRY;
+}
+
+static void
+stream_reserve(struct tracer_stream *stream, size_t count)
+{
+    size_t capacity;
+    char *data;
+
+    if (stream->capacity - stream->size >= count)
+        return;
+
+    capacity = stream->capacity == 0 ? STREAM_INITIAL_CAPACITY : stream->capacity;
+    while (capacity - stream->size < count)
+        capacity *= 2;
+
+    data = realloc(stream->data, capacity);
+    if (data == NULL) {
+        fprintf(stderr, "Failed to grow output stream: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    stream->data = data;
+    stream->capacity = capacity;
+}
+
+// Move the data of src at the end of dst
+static void
+stream_append(struct tracer_stream *dst, struct tracer_stream *src)
+{
+    char *data;
+    size_t capacity;
+
+    if (src->size == 0)
+        return;
+
+    if (dst->pos == dst->size) {
+        // dst is drained, swap the buffers
+        data = dst->data;
+        capacity = dst->capacity;
+        dst->data = src->data;
+        dst->capacity = src->capacity;
+        dst->size = src->size;
+        dst->pos = 0;
+        src->data = data;
+        src->capacity = capacity;
+    }
+    else {
+        if (dst->pos > 0) {
+            memmove(dst->data, dst->data + dst->pos, dst->size - dst->pos);
+            dst->size -= dst->pos;
+            dst->pos = 0;
+        }
+        stream_reserve(dst, src->size);
+        memcpy(dst->data + dst->size, src->data, src->size);
+        dst->size += src->size;
+    }
+
+    src->size = 0;
+    src->pos = 0;
+}
+
+void
+tracer_stream_begin(struct tracer_stream *stream, uint64_t time)
+{
+    struct tracer_stream_entry entry = { time, 0, 0 };
+
+    tracer_stream_end(stream);
+    stream_reserve(stream, sizeof entry);
+    memcpy(stream->data + stream->size, &entry, sizeof entry);
+    stream->entry = stream->size;
+    stream->size += sizeof entry;
+}
+
+void
+tracer_stream_write(struct tracer_stream *stream, const void *data, size_t count)
+{
+    if (stream->entry == STREAM_NO_ENTRY)
+        tracer_stream_begin(stream, tracer_monotonic_time());
+
+    stream_reserve(stream, count);
+    memcpy(stream->data + stream->size, data, count);
+    stream->size += count;
+}
+
+void
+tracer_stream_vprintf(struct tracer_stream *stream, const char *fmt, va_list ap)
+{
+    va_list aq;
+    int len;
+
+    if (stream->entry == STREAM_NO_ENTRY)
+        tracer_stream_begin(stream, tracer_monotonic_time());
+
+    va_copy(aq, ap);
+    len = vsnprintf(stream->data + stream->size, stream->capacity - stream->size, fmt, aq);
+    va_end(aq);
+    if (len < 0)
+        return;
+
+    if ((size_t) len >= stream->capacity - stream->size) {
+        stream_reserve(stream, len + 1);
+        vsnprintf(stream->data + stream->size, stream->capacity - stream->size, fmt, ap);
+    }
+    stream->size += len;
+}
+
+void
+tracer_stream_end(struct tracer_stream *stream)
+{
+    struct tracer_stream_entry entry;
+
+    if (stream->entry == STREAM_NO_ENTRY)
+        return;
+
+    memcpy(&entry, stream->data + stream->entry, sizeof entry);
+    entry.size = stream->size - stream->entry - sizeof entry;
+    memcpy(stream->data + stream->entry, &entry, sizeof entry);
+    stream->entry = STREAM_NO_ENTRY;
+}
+
+/**************************************************************************************************/
+
+static int
+worker_init(struct tracer_worker *worker, struct tracer_worker_pool *pool)
+{
+    struct epoll_event ev;
+
+    worker->pool = pool;
+    wl_list_init(&worker->instance_list);
+    wl_list_init(&worker->hup_list);
+    wl_list_init(&worker->ready_list);
+    wl_list_init(&worker->incoming);
+    stream_init(&worker->local);
+    stream_init(&worker->published);
+    stream_init(&worker->pending);
+    worker->load = 0;
+    worker->busy = 0;
+    worker->watermark = 0;
+    worker->stop = 0;
+    pthread_mutex_init(&worker->lock, NULL);
+
+    worker->epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (worker->epollfd < 0)
+        return -1;
+
+    worker->eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (worker->eventfd < 0)
+        return -1;
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = worker;
+    return epoll_ctl(worker->epollfd, EPOLL_CTL_ADD, worker->eventfd, &ev);
+}
+
+struct tracer_worker_pool *
+tracer_worker_pool_create(struct tracer *tracer, int count)
+{
+    struct tracer_worker_pool *pool;
+    int i;
+
+    pool = calloc(1, sizeof *pool);
+    if (pool == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    pool->workers = calloc(count, sizeof *pool->workers);
+    if (pool->workers == NULL) {
+        free(pool);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    pool->tracer = tracer;
+    pool->count = count;
+    pool->next = 0;
+    pool->armed = 0;
+    pool->dump_requested = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+
+    pool->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (pool->timerfd < 0)
+        return NULL;
+
+    for (i = 0; i < count; i++) {
+        if (worker_init(&pool->workers[i], pool) < 0)
+            return NULL;
+    }
+
+    return pool;
+}
+
+int
+tracer_worker_pool_start(struct tracer_worker_pool *pool, void *(*run)(void *))
+{
+    int i;
+
+    for (i = 0; i < pool->count; i++) {
+        if (pthread_create(&pool->workers[i].thread, NULL, run, &pool->workers[i]) != 0) {
+            pool->count = i;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Stop the workers and write all their output
+void
+tracer_worker_pool_stop(struct tracer_worker_pool *pool)
+{
+    struct tracer_worker *worker;
+    uint64_t one = 1;
+    int i;
+
+    for (i = 0; i < pool->count; i++) {
+        worker = &pool->workers[i];
+        pthread_mutex_lock(&worker->lock);
+        worker->stop = 1;
+        pthread_mutex_unlock(&worker->lock);
+        if (write(worker->eventfd, &one, sizeof one) < 0)
+            fprintf(stderr, "Failed to wake up worker %d: %m\n", i);
+    }
+
+    for (i = 0; i < pool->count; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+
+    tracer_worker_pool_merge(pool, 1);
+}
+
+/**************************************************************************************************/
+
+// Hand an instance over to the least loaded worker
+void
+tracer_worker_pool_assign(struct tracer_worker_pool *pool, struct tracer_instance *instance)
+{
+    struct tracer_worker *worker, *best = NULL;
+    int i, index, load, best_load = 0, best_index = 0;
+    uint64_t one = 1;
+
+    for (i = 0; i < pool->count; i++) {
+        index = (pool->next + i) % pool->count;
+        worker = &pool->workers[index];
+        pthread_mutex_lock(&worker->lock);
+        load = worker->load;
+        pthread_mutex_unlock(&worker->lock);
+        if (best == NULL || load < best_load) {
+            best = worker;
+            best_load = load;
+            best_index = index;
+        }
+    }
+    pool->next = (best_index + 1) % pool->count;
+
+    instance->worker = best;
+    pthread_mutex_lock(&best->lock);
+    wl_list_insert(best->incoming.prev, &instance->link);
+    best->load++;
+    pthread_mutex_unlock(&best->lock);
+
+    if (write(best->eventfd, &one, sizeof one) < 0)
+        fprintf(stderr, "Failed to wake up worker: %m\n");
+}
+
+// Called by a worker when its eventfd is readable
+void
+tracer_worker_take_incoming(struct tracer_worker *worker, struct wl_list *list, int *stop)
+{
+    uint64_t count;
+
+    if (read(worker->eventfd, &count, sizeof count) < 0 && errno != EAGAIN)
+        fprintf(stderr, "Failed to read worker event: %m\n");
+
+    pthread_mutex_lock(&worker->lock);
+    wl_list_insert_list(list, &worker->incoming);
+    wl_list_init(&worker->incoming);
+    *stop = worker->stop;
+    pthread_mutex_unlock(&worker->lock);
+}
+
+// Called by a worker when one of its instances is destroyed
+void
+tracer_worker_release(struct tracer_worker *worker)
+{
+    pthread_mutex_lock(&worker->lock);
+    worker->load--;
+    pthread_mutex_unlock(&worker->lock);
+}
+
+/**************************************************************************************************/
+
+// Schedule a merge
+static void
+pool_kick(struct tracer_worker_pool *pool)
+{
+    struct itimerspec its = { { 0, 0 }, { 0, TRACER_MERGE_DELAY_MS * 1000000L } };
+
+    pthread_mutex_lock(&pool->lock);
+    if (!pool->armed && timerfd_settime(pool->timerfd, 0, &its, NULL) == 0)
+        pool->armed = 1;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void
+tracer_worker_begin_batch(struct tracer_worker *worker)
+{
+    pthread_mutex_lock(&worker->lock);
+    worker->busy = 1;
+    pthread_mutex_unlock(&worker->lock);
+}
+
+// Publish the output of the batch
+void
+tracer_worker_end_batch(struct tracer_worker *worker)
+{
+    uint64_t now;
+    int published;
+
+    tracer_stream_end(&worker->local);
+    published = worker->local.size > 0;
+    now = tracer_monotonic_time();
+
+    pthread_mutex_lock(&worker->lock);
+    stream_append(&worker->published, &worker->local);
+    worker->busy = 0;
+    worker->watermark = now;
+    pthread_mutex_unlock(&worker->lock);
+
+    if (published)
+        pool_kick(worker->pool);
+}
+
+// Called by a worker, the dump is done by the main thread once the output is merged
+void
+tracer_worker_pool_request_dump(struct tracer_worker_pool *pool, const char *reason)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->dump_requested = 1;
+    snprintf(pool->dump_reason, sizeof pool->dump_reason, "%s", reason);
+    pthread_mutex_unlock(&pool->lock);
+
+    pool_kick(pool);
+}
+
+/**************************************************************************************************/
+
+static void
+pool_sink(struct tracer_worker_pool *pool, const char *data, uint32_t size)
+{
+    struct tracer *tracer = pool->tracer;
+
+    if (tracer->recorder != NULL) {
+        tracer_recorder_begin(tracer->recorder, size);
+        tracer_recorder_append(tracer->recorder, data, size);
+        tracer_recorder_end(tracer->recorder);
+    }
+    else {
+        tracer_writer_write(tracer->writer, data, size);
+    }
+}
+
+// Write the entries of the workers in time order, up to the oldest watermark of the busy workers
+// or all of them. Return non-zero if entries are left.
+int
+tracer_worker_pool_merge(struct tracer_worker_pool *pool, int all)
+{
+    struct tracer_stream_entry entry, best_entry;
+    struct tracer_worker *worker;
+    struct tracer_stream *best;
+    uint64_t limit = UINT64_MAX;
+    int i, left = 0;
+
+    for (i = 0; i < pool->count; i++) {
+        worker = &pool->workers[i];
+        pthread_mutex_lock(&worker->lock);
+        stream_append(&worker->pending, &worker->published);
+        if (worker->busy && worker->watermark < limit)
+            limit = worker->watermark;
+        pthread_mutex_unlock(&worker->lock);
+    }
+
+    if (all)
+        limit = UINT64_MAX;
+
+    for (;;) {
+        best = NULL;
+        for (i = 0; i < pool->count; i++) {
+            struct tracer_stream *stream = &pool->workers[i].pending;
+            if (stream->pos == stream->size)
+                continue;
+            memcpy(&entry, stream->data + stream->pos, sizeof entry);
+            if (best == NULL || entry.time < best_entry.time) {
+                best = stream;
+                best_entry = entry;
+            }
+        }
+
+        if (best == NULL)
+            break;
+        if (best_entry.time >= limit) {
+            left = 1;
+            break;
+        }
+
+        pool_sink(pool, best->data + best->pos + sizeof best_entry, best_entry.size);
+        best->pos += sizeof best_entry + best_entry.size;
+    }
+
+    return left;
+}
+
+// Called when the merge timer expires
+int
+tracer_worker_pool_handle_timer(struct tracer_worker_pool *pool)
+{
+    struct tracer *tracer = pool->tracer;
+    char reason[sizeof pool->dump_reason];
+    uint64_t expirations;
+    int dump;
+
+    if (read(pool->timerfd, &expirations, sizeof expirations) < 0 && errno != EAGAIN)
+        return -1;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->armed = 0;
+    dump = pool->dump_requested;
+    pool->dump_requested = 0;
+    memcpy(reason, pool->dump_reason, sizeof reason);
+    pthread_mutex_unlock(&pool->lock);
+
+    if (tracer_worker_pool_merge(pool, 0))
+        pool_kick(pool);
+
+    if (tracer->options->flush_each_message)
+        tracer_writer_flush(tracer->writer);
+
+    if (dump && tracer->recorder != NULL)
+        tracer_recorder_dump(tracer->recorder, reason);
+
+    return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef TRACER_WORKER_H
+#define TRACER_WORKER_H
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wayland-util.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Maximum number of worker threads
+#define TRACER_MAX_WORKERS 64
+// Delay before the output of the workers is merged
+#define TRACER_MERGE_DELAY_MS 1
+
+struct tracer;
+struct tracer_instance;
+
+// Output of a worker: a sequence of entries, each a tracer_stream_entry followed by its data.
+// Entries of a stream are in time order.
+struct tracer_stream_entry
+{
+    uint64_t time;              // CLOCK_MONOTONIC, in ns
+    uint32_t size;              // of the data
+    uint32_t padding;
+};
+
+struct tracer_stream
+{
+    char *data;
+    size_t size, capacity;
+    size_t pos;                 // next entry to merge
+    size_t entry;               // open entry, or (size_t) -1
+};
+
+// In server mode instances can be spread over worker threads, each with its own epoll set. A
+// worker buffers its output in its own stream and publishes it after each batch of events, the
+// main thread merges the streams of all the workers in time order into the output.
+//
+// A worker is busy while it handles a batch, its watermark is the time its last batch ended: it
+// can not produce an entry older than that anymore. The main thread only merges the entries older
+// than the watermark of every busy worker, idle workers do not hold it back.
+struct tracer_worker
+{
+    struct tracer_worker_pool *pool;
+    pthread_t thread;
+    int epollfd;
+    int eventfd;                // wakes the worker up for new instances and to stop
+    struct wl_list instance_list;
+    struct wl_list hup_list;
+    struct wl_list ready_list;
+    uint64_t idle_due;          // next pass over instance_list shrinking the idle buffers
+    struct tracer_stream local;     // owned by the worker
+
+    pthread_mutex_t lock;       // protects the fields below
+    struct wl_list incoming;    // instances handed over by the main thread
+    int load;                   // instances assigned to the worker
+    int busy;
+    uint64_t watermark;
+    int stop;
+    struct tracer_stream published;
+
+    struct tracer_stream pending;   // owned by the main thread
+};
+
+struct tracer_worker_pool
+{
+    struct tracer *tracer;
+    struct tracer_worker *workers;
+    int count;
+    int next;                   // round-robin among the least loaded workers
+    int timerfd;                // merge timer, in the main epoll set
+
+    pthread_mutex_t lock;       // protects the fields below
+    int armed;
+    int dump_requested;
+    char dump_reason[64];
+};
+
+struct tracer_worker_pool *tracer_worker_pool_create(struct tracer *tracer, int count);
+int tracer_worker_pool_start(struct tracer_worker_pool *pool, void *(*run)(void *));
+void tracer_worker_pool_stop(struct tracer_worker_pool *pool);
+
+void tracer_worker_pool_assign(struct tracer_worker_pool *pool, struct tracer_instance *instance);
+int tracer_worker_pool_merge(struct tracer_worker_pool *pool, int all);
+int tracer_worker_pool_handle_timer(struct tracer_worker_pool *pool);
+void tracer_worker_pool_request_dump(struct tracer_worker_pool *pool, const char *reason);
+
+void tracer_worker_begin_batch(struct tracer_worker *worker);
+void tracer_worker_end_batch(struct tracer_worker *worker);
+void tracer_worker_take_incoming(struct tracer_worker *worker, struct wl_list *list, int *stop);
+void tracer_worker_release(struct tracer_worker *worker);
+
+void tracer_stream_begin(struct tracer_stream *stream, uint64_t time);
+void tracer_stream_write(struct tracer_stream *stream, const void *data, size_t count);
+void tracer_stream_vprintf(struct tracer_stream *stream, const char *fmt, va_list ap);
+void tracer_stream_end(struct tracer_stream *stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,185 @@
+// -*- mode: C; c-basic-offset: 4 -*-
+
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "tracer-writer.h"
+
+/**************************************************************************************************/
+
+struct tracer_writer *
+tracer_writer_create(int fd, size_t capacity)
+{
+    struct tracer_writer *writer;
+
+    writer = malloc(sizeof *writer);
+    if (writer == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    writer->data = malloc(capacity);
+    if (writer->data == NULL) {
+        free(writer);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    writer->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (writer->timerfd < 0) {
+        free(writer->data);
+        free(writer);
+        return NULL;
+    }
+
+    writer->fd = fd;
+    writer->armed = 0;
+    writer->size = 0;
+    writer->capacity = capacity;
+
+    return writer;
+}
+
+void
+tracer_writer_destroy(struct tracer_writer *writer)
+{
+    tracer_writer_flush(writer);
+    close(writer->timerfd);
+    free(writer->data);
+    free(writer);
+}
+
+/**************************************************************************************************/
+
+static int
+write_all(int fd, const char *data, size_t count)
+{
+    ssize_t len;
+
+    while (count > 0) {
+        len = write(fd, data, count);
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += len;
+        count -= len;
+    }
+
+    return 0;
+}
+
+int
+tracer_writer_flush(struct tracer_writer *writer)
+{
+    int rc;
+
+    if (writer->size == 0)
+        return 0;
+
+    rc = write_all(writer->fd, writer->data, writer->size);
+    writer->size = 0;
+
+    return rc;
+}
+
+// Start the flush timer when the first data enters an empty buffer
+static void
+tracer_writer_commit(struct tracer_writer *writer, size_t count)
+{
+    struct itimerspec its = { 0 };
+
+    if (writer->size == 0 && count > 0 && !writer->armed) {
+        its.it_value.tv_sec = TRACER_WRITER_FLUSH_INTERVAL_MS / 1000;
+        its.it_value.tv_nsec = (TRACER_WRITER_FLUSH_INTERVAL_MS % 1000) * 1000000L;
+        if (timerfd_settime(writer->timerfd, 0, &its, NULL) == 0)
+            writer->armed = 1;
+    }
+
+    writer->size += count;
+}
+
+// Called when the timer fd is readable
+int
+tracer_writer_handle_timer(struct tracer_writer *writer)
+{
+    uint64_t expirations;
+
+    if (read(writer->timerfd, &expirations, sizeof expirations) < 0 && errno != EAGAIN)
+        return -1;
+    writer->armed = 0;
+
+    return tracer_writer_flush(writer);
+}
+
+/**************************************************************************************************/
+
+void
+tracer_writer_write(struct tracer_writer *writer, const void *data, size_t count)
+{
+    if (count > writer->capacity - writer->size) {
+        tracer_writer_flush(writer);
+        // larger than the buffer, bypass it
+        if (count > writer->capacity) {
+            write_all(writer->fd, data, count);
+            return;
+        }
+    }
+
+    memcpy(writer->data + writer->size, data, count);
+    tracer_writer_commit(writer, count);
+}
+
+void
+tracer_writer_vprintf(struct tracer_writer *writer, const char *fmt, va_list ap)
+{
+    va_list aq;
+    int len;
+
+    // format in place, flush and retry if the record does not fit
+    va_copy(aq, ap);
+    len = vsnprintf(writer->data + writer->size, writer->capacity - writer->size, fmt, aq);
+    va_end(aq);
+    if (len < 0)
+        return;
+
+    if ((size_t) len >= writer->capacity - writer->size) {
+        tracer_writer_flush(writer);
+        if ((size_t) len >= writer->capacity) {
+            vdprintf(writer->fd, fmt, ap);
+            return;
+        }
+        len = vsnprintf(writer->data, writer->capacity, fmt, ap);
+    }
+
+    tracer_writer_commit(writer, len);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright © 2014 Boyan Ding
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef TRACER_WRITER_H
+#define TRACER_WRITER_H
+
+#include <stdarg.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Size of the output buffer
+#define TRACER_WRITER_SIZE (1 << 20)
+// Maximum time data can stay in the buffer
+#define TRACER_WRITER_FLUSH_INTERVAL_MS 100
+
+// The writer accumulates the trace in a large buffer, which is written when it is full, when the
+// flush timer expires or on request. This keeps write syscalls out of the forwarding path.
+struct tracer_writer
+{
+    int fd;
+    int timerfd;
+    int armed;
+    char *data;
+    size_t size, capacity;
+};
+
+struct tracer_writer *tracer_writer_create(int fd, size_t capacity);
+void tracer_writer_destroy(struct tracer_writer *writer);
+
+void tracer_writer_write(struct tracer_writer *writer, const void *data, size_t count);
+void tracer_writer_vprintf(struct tracer_writer *writer, const char *fmt, va_list ap);
+
+int tracer_writer_flush(struct tracer_writer *writer);
+int tracer_writer_handle_timer(struct tracer_writer *writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -23,20 +23,27 @@
  */
 
 #include <assert.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
 #include <sys/file.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/un.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -45,8 +52,18 @@
 #include "wayland-util.h"
 #include "tracer.h"
 #include "tracer-analyzer.h"
+#include "tracer-filter.h"
+#include "tracer-queue.h"
+#include "tracer-record.h"
+#include "tracer-clock.h"
+#include "tracer-latency.h"
+#include "tracer-stats.h"
+#include "tracer-recorder.h"
+#include "tracer-worker.h"
+#include "tracer-writer.h"
 #include "frontend-analyze.h"
 #include "frontend-bin.h"
+#include "frontend-record.h"
 
 /**************************************************************************************************/
 
@@ -57,6 +74,29 @@
 #define LOCK_SUFFIX ".lock"
 #define LOCK_SUFFIXLEN 5
 
+// Maximum number of ready events drained per epoll_wait() call
+#define TRACER_MAX_EVENTS 64
+
+// Delay before connecting again to a compositor whose backlog was full
+#define TRACER_CONNECT_RETRY_MS 1
+
+// Maximum number of connections to the compositor kept ready by --upstream-pool
+#define TRACER_MAX_UPSTREAM_POOL 256
+
+// Delay before replacing a connection taken from the pool, the compositor sets up the new one
+// after the first round-trips of the client instead of during them
+#define TRACER_POOL_REFILL_MS 5
+
+// Bytes read from a connection per wakeup in edge-triggered mode before the others get a turn
+#define TRACER_DEFAULT_READ_BUDGET (256 * 1024)
+
+// Period of the pass giving back the buffers of the idle connections, see tracer_shrink_idle()
+#define TRACER_IDLE_SHRINK_MS 1000
+
+#ifndef WAYLAND_PROTOCOLS_DATADIR
+#define WAYLAND_PROTOCOLS_DATADIR "/usr/share/wayland-protocols"
+#endif
+
 /**************************************************************************************************/
 
 /* A simple copy of wl_socket in wayland-server.c */
@@ -66,6 +106,19 @@ struct tracer_socket
     int fd_lock;
     struct sockaddr_un addr;
     char lock_addr[UNIX_PATH_MAX + LOCK_SUFFIXLEN];
+    // the compositor, resolved once for all the clients
+    struct sockaddr_un upstream;
+    socklen_t upstream_size;
+    // --upstream-pool: connections to the compositor established ahead of the clients, see
+    // tracer_pool_refill()
+    int *pool;
+    int pool_size, pool_count;
+    // time of the next refill
+    uint64_t pool_due;
+    // the connection of the pool which found the backlog of the compositor full, -1 without
+    int pool_connecting;
+    // the compositor refused the last connection, the pool is refilled after the next client
+    int pool_failed;
 };
 
 /**************************************************************************************************/
@@ -77,14 +130,80 @@ tracer_print(struct tracer *tracer, const char *fmt, ...)
     va_list ap;
 
     va_start(ap, fmt);
-    vfprintf(tracer->outfp, fmt, ap);
+    tracer_writer_vprintf(tracer->writer, fmt, ap);
     va_end(ap);
 }
 
 void
 tracer_vprint(struct tracer *tracer, const char *fmt, va_list ap)
 {
-    vfprintf(tracer->outfp, fmt, ap);
+    tracer_writer_vprintf(tracer->writer, fmt, ap);
+}
+
+/**************************************************************************************************/
+
+// The output of an instance goes to the stream of its worker, the flight recorder, the queue of
+// the writer thread or the writer. An entry is a binary record or the text from a tracer_log() to
+// the next one, time orders the entries of the workers (0 for now), size is the size of a binary
+// record.
+void
+tracer_output_begin(struct tracer_instance *instance, uint64_t time, uint32_t size)
+{
+    struct tracer *tracer = instance->tracer;
+
+    if (instance->worker != NULL)
+        tracer_stream_begin(&instance->worker->local, time != 0 ? time : tracer_monotonic_time());
+    else if (tracer->recorder != NULL)
+        tracer_recorder_begin(tracer->recorder, size);
+    else if (tracer->queue != NULL)
+        tracer_queue_begin(tracer->queue, size);
+}
+
+void
+tracer_output_write(struct tracer_instance *instance, const void *data, size_t count)
+{
+    struct tracer *tracer = instance->tracer;
+
+    if (instance->worker != NULL)
+        tracer_stream_write(&instance->worker->local, data, count);
+    else if (tracer->recorder != NULL)
+        tracer_recorder_append(tracer->recorder, data, count);
+    else if (tracer->queue != NULL)
+        tracer_queue_append(tracer->queue, data, count);
+    else
+        tracer_writer_write(tracer->writer, data, count);
+}
+
+void
+tracer_output_vprintf(struct tracer_instance *instance, const char *fmt, va_list ap)
+{
+    if (instance->worker != NULL)
+        tracer_stream_vprintf(&instance->worker->local, fmt, ap);
+    else
+        tracer_writer_vprintf(instance->tracer->writer, fmt, ap);
+}
+
+void
+tracer_output_end(struct tracer_instance *instance)
+{
+    struct tracer *tracer = instance->tracer;
+
+    if (instance->worker != NULL)
+        tracer_stream_end(&instance->worker->local);
+    else if (tracer->recorder != NULL)
+        tracer_recorder_end(tracer->recorder);
+    else if (tracer->queue != NULL)
+        tracer_queue_end(tracer->queue);
+}
+
+static void
+tracer_output_printf(struct tracer_instance *instance, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    tracer_output_vprintf(instance, fmt, ap);
+    va_end(ap);
 }
 
 /**************************************************************************************************/
@@ -92,21 +211,22 @@ tracer_vprint(struct tracer *tracer, const char *fmt, va_list ap)
 void
 tracer_log_impl(struct tracer_instance *instance, const char *fmt, ...)
 {
-    struct timespec tp;
-    unsigned int time;
     struct tracer *tracer = instance->tracer;
+    // the messages of a read share its timestamp, no clock is read here
+    uint64_t time = instance->time + tracer->time_offset;
     va_list ap;
 
-    clock_gettime(CLOCK_REALTIME, &tp);
-    time = (tp.tv_sec * 1000000L) + (tp.tv_nsec / 1000);
+    if (instance->worker != NULL)
+        tracer_output_begin(instance, instance->time, 0);
 
-    tracer_print(tracer, "[%10.3f] ", time / 1000.0);
+    tracer_output_printf(instance, "[%" PRIu64 ".%06u] ", time / 1000000000,
+                         (unsigned int) (time % 1000000000 / 1000));
 
-    if (tracer->socket != NULL)
-        tracer_print(tracer, "%d: ", instance->id);
+    if (tracer->options->mode == TRACER_MODE_SERVER)
+        tracer_output_printf(instance, "%d: ", instance->id);
 
     va_start(ap, fmt);
-    tracer_vprint(tracer, fmt, ap);
+    tracer_output_vprintf(instance, fmt, ap);
     va_end(ap);
 }
 
@@ -116,7 +236,7 @@ tracer_log_cont_impl(struct tracer_instance *instance, const char *fmt, ...)
     va_list ap;
 
     va_start(ap, fmt);
-    tracer_vprint(instance->tracer, fmt, ap);
+    tracer_output_vprintf(instance, fmt, ap);
     va_end(ap);
 }
 
@@ -125,8 +245,11 @@ tracer_log_end_impl(struct tracer_instance *instance)
 {
     struct tracer *tracer = instance->tracer;
 
-    tracer_print(tracer, "\n");
-    fflush(tracer->outfp);
+    tracer_output_printf(instance, "\n");
+    if (instance->worker != NULL)
+        tracer_output_end(instance);
+    else if (tracer->options->flush_each_message)
+        tracer_writer_flush(tracer->writer);
 }
 
 /**************************************************************************************************/
@@ -134,13 +257,12 @@ tracer_log_end_impl(struct tracer_instance *instance)
 
 // The following two functions are taken from wayland-client.c
 
+// Address of the compositor socket NAME in XDG_RUNTIME_DIR, WAYLAND_DISPLAY or wayland-0 if NULL
 static int
-tracer_connect_to_socket(const char *name)
+tracer_socket_address(const char *name, struct sockaddr_un *addr, socklen_t *size)
 {
     const char *runtime_dir;
-    int name_size, fd;
-    struct sockaddr_un addr;
-    socklen_t size;
+    int name_size;
 
     // XDG_RUNTIME_DIR=/run/user/<UID>
     runtime_dir = getenv("XDG_RUNTIME_DIR");
@@ -157,27 +279,39 @@ tracer_connect_to_socket(const char *name)
     if (name == NULL)
         name = "wayland-0";
 
-    // socket(domain, type | SOCK_CLOEXEC, protocol)
-    fd = wl_os_socket_cloexec(PF_LOCAL, SOCK_STREAM, 0);
-    if (fd < 0)
-        return -1;
-
-    memset(&addr, 0, sizeof addr);
-    addr.sun_family = AF_LOCAL;
-    name_size = snprintf(addr.sun_path, sizeof addr.sun_path, "%s/%s", runtime_dir, name) + 1;
+    memset(addr, 0, sizeof *addr);
+    addr->sun_family = AF_LOCAL;
+    name_size = snprintf(addr->sun_path, sizeof addr->sun_path, "%s/%s", runtime_dir, name) + 1;
 
     assert(name_size > 0);
-    if (name_size > (int) sizeof addr.sun_path) {
+    if (name_size > (int) sizeof addr->sun_path) {
         fprintf(stderr, "error: socket path \"%s/%s\" plus null terminator"
                 " exceeds 108 bytes\n", runtime_dir, name);
-        close(fd);
         /* to prevent programs reporting
          * "failed to add socket: Success" */
         errno = ENAMETOOLONG;
         return -1;
     };
 
-    size = offsetof(struct sockaddr_un, sun_path) + name_size;
+    *size = offsetof(struct sockaddr_un, sun_path) + name_size;
+
+    return 0;
+}
+
+static int
+tracer_connect_to_socket(const char *name)
+{
+    struct sockaddr_un addr;
+    socklen_t size;
+    int fd;
+
+    if (tracer_socket_address(name, &addr, &size) < 0)
+        return -1;
+
+    // socket(domain, type | SOCK_CLOEXEC, protocol)
+    fd = wl_os_socket_cloexec(PF_LOCAL, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
 
     if (connect(fd, (struct sockaddr *) &addr, size) < 0) {
         close(fd);
@@ -280,6 +414,11 @@ tracer_create_socket(struct tracer *tracer, const char *name)
     if (s == NULL)
         return -1;
 
+    if (tracer_socket_address(NULL, &s->upstream, &s->upstream_size) < 0) {
+        free(s);
+        return -1;
+    }
+
     runtime_dir = getenv("XDG_RUNTIME_DIR");
     if (!runtime_dir) {
         wl_log("error: XDG_RUNTIME_DIR not set in the environment\n");
@@ -287,12 +426,16 @@ tracer_create_socket(struct tracer *tracer, const char *name)
         /* to prevent programs reporting
          * "failed to add socket: Success" */
         errno = ENOENT;
+        free(s);
         return -1;
     }
 
-    s->fd = wl_os_socket_cloexec(PF_LOCAL, SOCK_STREAM, 0);
-    if (s->fd < 0)
+    // accepted until EAGAIN, see tracer_handle_client()
+    s->fd = wl_os_socket_cloexec(PF_LOCAL, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (s->fd < 0) {
+        free(s);
         return -1;
+    }
 
     if (name == NULL)
         name = getenv("WAYLAND_DISPLAY");
@@ -332,7 +475,8 @@ tracer_create_socket(struct tracer *tracer, const char *name)
         return -1;
     }
 
-    if (listen(s->fd, 1) < 0) {
+    // the clients of a session starting at once wait in the backlog, they are not refused
+    if (listen(s->fd, SOMAXCONN) < 0) {
         fprintf(stderr, "listen() failed with error: %m\n");
         unlink(s->addr.sun_path);
         close(s->fd);
@@ -342,6 +486,24 @@ tracer_create_socket(struct tracer *tracer, const char *name)
         return -1;
     }
 
+    s->pool_size = tracer->options->upstream_pool;
+    s->pool_count = 0;
+    s->pool_due = 0;
+    s->pool_connecting = -1;
+    s->pool_failed = 0;
+    s->pool = NULL;
+    if (s->pool_size > 0) {
+        s->pool = malloc(s->pool_size * sizeof *s->pool);
+        if (s->pool == NULL) {
+            unlink(s->addr.sun_path);
+            close(s->fd);
+            unlink(s->lock_addr);
+            close(s->fd_lock);
+            free(s);
+            return -1;
+        }
+    }
+
     tracer_epoll_add_fd(tracer, s->fd, NULL);
     tracer->socket = s;
 
@@ -352,7 +514,7 @@ tracer_create_socket(struct tracer *tracer, const char *name)
 /**************************************************************************************************/
 
 static struct tracer_connection *
-tracer_connection_create(int fd, int side)
+tracer_connection_create(struct tracer *tracer, int fd, int side)
 {
     struct tracer_connection *connection;
 
@@ -365,30 +527,210 @@ tracer_connection_create(int fd, int side)
     connection->wl_conn = wl_connection_create(fd);
     if (connection->wl_conn == NULL)
         return NULL;
+    wl_connection_set_max_buffer_size(connection->wl_conn, tracer->options->max_buffer_size);
 
     connection->side = side;
+    connection->events = EPOLLIN | (tracer->options->edge_triggered ? EPOLLET : 0);
+    connection->ready = 0;
+    connection->high_watermark = (uint32_t) 1 << connection->wl_conn->in.max_size_bits;
+    connection->low_watermark = connection->high_watermark / 4;
+    connection->paused = 0;
+    connection->closing = 0;
 
     return connection;
 }
 
+static int
+tracer_connection_epollfd(struct tracer_connection *connection)
+{
+    struct tracer_instance *instance = connection->instance;
+
+    return instance->worker != NULL ? instance->worker->epollfd : instance->tracer->epollfd;
+}
+
 static void
 tracer_connection_destroy(struct tracer_connection *connection)
 {
     struct wl_connection *wl_conn = connection->wl_conn;
-    struct tracer *tracer = connection->instance->tracer;
 
-    epoll_ctl(tracer->epollfd, EPOLL_CTL_DEL, wl_conn->fd, NULL);
-    wl_connection_destroy(connection->wl_conn);
+    // already removed if it was closing
+    epoll_ctl(tracer_connection_epollfd(connection), EPOLL_CTL_DEL, wl_conn->fd, NULL);
+    if (connection->ready)
+        wl_list_remove(&connection->ready_link);
+    close(wl_connection_destroy(connection->wl_conn));
     free(connection);
 }
 
+static int
+tracer_connection_watch(struct tracer_connection *connection)
+{
+    struct epoll_event ev;
+    ev.events = connection->events;
+    ev.data.ptr = connection;
+
+    return epoll_ctl(tracer_connection_epollfd(connection), EPOLL_CTL_ADD, connection->wl_conn->fd,
+                     &ev);
+}
+
+// Pause or resume the reads according to the output queued for the peer, and watch for writing
+// while output is queued for this connection. epoll is only told about changes, a connection
+// whose peer keeps up costs no extra system call.
+static void
+tracer_connection_update(struct tracer_connection *connection)
+{
+    uint32_t queued = wl_connection_pending_output(connection->peer->wl_conn);
+    struct epoll_event ev;
+
+    if (connection->closing)
+        return;
+
+    if (!connection->paused && queued >= connection->high_watermark)
+        connection->paused = 1;
+    else if (connection->paused && queued <= connection->low_watermark)
+        connection->paused = 0;
+
+    ev.events = (connection->paused ? 0 : EPOLLIN) | (connection->events & EPOLLET);
+    if (wl_connection_pending_output(connection->wl_conn) != 0)
+        ev.events |= EPOLLOUT;
+    if (ev.events == connection->events)
+        return;
+
+    ev.data.ptr = connection;
+    if (epoll_ctl(tracer_connection_epollfd(connection), EPOLL_CTL_MOD, connection->wl_conn->fd,
+                  &ev) == 0)
+        connection->events = ev.events;
+}
+
+// EPOLLHUP can't be masked, a connection which hung up is removed from epoll while it is drained
+static void
+tracer_connection_close(struct tracer_connection *connection)
+{
+    epoll_ctl(tracer_connection_epollfd(connection), EPOLL_CTL_DEL, connection->wl_conn->fd, NULL);
+    connection->events = 0;
+    connection->closing = 1;
+}
+
 /**************************************************************************************************/
 /**************************************************************************************************/
 
+// Connect to the compositor without blocking. With its backlog full, connect() fails with EAGAIN
+// instead of waiting, *pending is then set and the connection is retried by
+// tracer_retry_connects(); a Unix socket can not be polled for a connection in progress.
+static int
+tracer_connect_upstream(struct tracer_socket *s, int *pending)
+{
+    int fd;
+
+    fd = wl_os_socket_cloexec(PF_LOCAL, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        return -1;
+
+    *pending = connect(fd, (struct sockaddr *) &s->upstream, s->upstream_size) < 0;
+    if (*pending && errno != EAGAIN) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Take a connection of the pool. The compositor does not write to a client before its first
+// request, a readable connection was closed by the compositor and is discarded.
+static int
+tracer_pool_take(struct tracer_socket *s)
+{
+    struct pollfd pfd;
+    int fd;
+
+    if (s->pool_size > 0)
+        s->pool_due = tracer_monotonic_time() + TRACER_POOL_REFILL_MS * 1000000ULL;
+
+    while (s->pool_count > 0) {
+        fd = s->pool[--s->pool_count];
+
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 0) == 0)
+            return fd;
+
+        close(fd);
+    }
+
+    return -1;
+}
+
+// Timeout of epoll_wait() until the next refill of the pool, 0 when it is due, -1 when the pool
+// is full or the compositor refuses the connections
+static int
+tracer_pool_timeout(struct tracer_socket *s)
+{
+    uint64_t now;
+
+    if (s == NULL || s->pool_count == s->pool_size || s->pool_failed)
+        return -1;
+
+    now = tracer_monotonic_time();
+    if (now >= s->pool_due)
+        return 0;
+
+    return (s->pool_due - now + 999999) / 1000000;
+}
+
+// Add one connection to the pool, one per iteration of the event loop so the clients are served
+// in between
+static void
+tracer_pool_refill(struct tracer_socket *s)
+{
+    int fd, pending;
+
+    if (s->pool_connecting >= 0) {
+        fd = s->pool_connecting;
+        pending = connect(fd, (struct sockaddr *) &s->upstream, s->upstream_size) < 0 &&
+            errno != EISCONN;
+        if (pending && errno != EAGAIN) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    else
+        fd = tracer_connect_upstream(s, &pending);
+
+    s->pool_connecting = -1;
+    if (fd < 0) {
+        s->pool_failed = 1;
+        return;
+    }
+
+    if (pending) {
+        s->pool_connecting = fd;
+        s->pool_due = tracer_monotonic_time() + TRACER_CONNECT_RETRY_MS * 1000000ULL;
+    }
+    else
+        s->pool[s->pool_count++] = fd;
+}
+
+// Start forwarding once connected to the compositor
+static void
+tracer_instance_start(struct tracer_instance *instance)
+{
+    struct tracer *tracer = instance->tracer;
+
+    // the worker registers the connections in its own epoll set
+    if (tracer->workers != NULL) {
+        tracer_worker_pool_assign(tracer->workers, instance);
+        return;
+    }
+
+    tracer_connection_watch(instance->server_conn);
+    tracer_connection_watch(instance->client_conn);
+
+    wl_list_insert(&tracer->instance_list, &instance->link);
+}
+
 static int
 tracer_instance_create(struct tracer *tracer, int clientfd)
 {
-    int serverfd;
+    int serverfd, pending = 0;
     struct tracer_instance *instance;
 
     // ??? XXX: Dirty hack, remove it later
@@ -399,20 +741,30 @@ tracer_instance_create(struct tracer *tracer, int clientfd)
         return -1;
     }
 
+    instance->stats = NULL;
+    if (tracer->stats != NULL) {
+        instance->stats = tracer_stats_instance_create(tracer->stats);
+        if (instance->stats == NULL) {
+            free(instance);
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
     // client mode
     // tracer acts as a client
     if (tracer->socket == NULL)
         serverfd = tracer_connect_server(NULL);
-    else
-        serverfd = tracer_connect_to_socket(NULL);
+    else if ((serverfd = tracer_pool_take(tracer->socket)) < 0)
+        serverfd = tracer_connect_upstream(tracer->socket, &pending);
     if (serverfd < 0)
         goto err_server;
 
-    instance->server_conn = tracer_connection_create(serverfd, TRACER_SERVER_SIDE);
+    instance->server_conn = tracer_connection_create(tracer, serverfd, TRACER_SERVER_SIDE);
     if (instance->server_conn == NULL)
         goto err_conn;
 
-    instance->client_conn = tracer_connection_create(clientfd, TRACER_CLIENT_SIDE);
+    instance->client_conn = tracer_connection_create(tracer, clientfd, TRACER_CLIENT_SIDE);
     if (instance->client_conn == NULL)
         goto err_conn;
 
@@ -422,32 +774,44 @@ tracer_instance_create(struct tracer *tracer, int clientfd)
     instance->server_conn->instance = instance;
     instance->client_conn->instance = instance;
 
-    wl_map_init(&instance->map, WL_MAP_CLIENT_SIDE);
+    tracer_objects_init(&instance->objects);
 
     if (analyzer != NULL) {
-        wl_map_insert_new(&instance->map, 0, NULL);
-        wl_map_insert_new(&instance->map, 0, analyzer->display_interface);
+        tracer_objects_insert(&instance->objects, 0, NULL);
+        tracer_objects_insert(&instance->objects, 1, analyzer->display_interface);
     }
 
-    tracer_epoll_add_fd(tracer, serverfd, instance->server_conn);
-    tracer_epoll_add_fd(tracer, clientfd, instance->client_conn);
-
     instance->tracer = tracer;
     instance->id = tracer->next_id;
+    instance->hup = 0;
+    instance->worker = NULL;
+    instance->filter_bits = NULL;
+    if (tracer->filter != NULL)
+        instance->filter_bits = tracer_filter_get(tracer->filter, instance->id);
+    instance->latency = NULL;
+    if (tracer->latency != NULL)
+        instance->latency = tracer_latency_instance_create(tracer->latency, instance->id);
     tracer->next_id++;
 
-    wl_list_insert(&tracer->instance_list, &instance->link);
+    // the client is not read until then, its data waits in its socket
+    if (pending)
+        wl_list_insert(tracer->connect_list.prev, &instance->link);
+    else
+        tracer_instance_start(instance);
+
     return 0;
 
     // Error Handling
   err_server:
     close(clientfd);
+    free(instance->stats);
     free(instance);
     return -1;
 
   err_conn:
     close(clientfd);
     close(serverfd);
+    free(instance->stats);
     free(instance);
     return -1;
 }
@@ -457,111 +821,698 @@ tracer_instance_create(struct tracer *tracer, int clientfd)
 static void
 tracer_instance_destroy(struct tracer_instance *instance)
 {
+    struct tracer *tracer = instance->tracer;
+
+    if (tracer->frontend->destroy != NULL)
+        tracer->frontend->destroy(instance);
+
     tracer_connection_destroy(instance->server_conn);
     tracer_connection_destroy(instance->client_conn);
 
     wl_list_remove(&instance->link);
+    tracer_objects_release(&instance->objects);
+    if (instance->worker != NULL)
+        tracer_worker_release(instance->worker);
+    if (instance->filter_bits != NULL)
+        tracer_filter_put(tracer->filter, instance->filter_bits);
+    if (instance->stats != NULL)
+        tracer_stats_instance_destroy(tracer->stats, instance->id, instance->stats);
+    if (instance->latency != NULL)
+        tracer_latency_instance_destroy(tracer, instance->latency);
 
     free(instance);
 }
 
 /**************************************************************************************************/
 
+// A client that goes away cleanly closes its socket between two messages, anything else is worth
+// keeping the flight recorder content: an error on the socket, a message cut short, or the
+// compositor dropping the client (e.g. after a protocol error)
+static int
+tracer_hup_is_abnormal(struct tracer_connection *connection, uint32_t events)
+{
+    if (events & EPOLLERR)
+        return 1;
+
+    if (connection->side == TRACER_SERVER_SIDE)
+        return 1;
+
+    return ring_buffer_size(&connection->wl_conn->in) != 0;
+}
+
+// The instance is only moved to the hup list here: events later in the same epoll batch can
+// still point to its connections, it is destroyed by tracer_release_hup() once the batch is done.
+static void
+tracer_handle_hup(struct tracer_connection *connection, uint32_t events)
+{
+    struct tracer_instance *instance = connection->instance;
+    struct tracer *tracer = instance->tracer;
+
+    if (instance->hup)
+        return;
+
+    // in single mode the exit status of the child is checked instead
+    if (tracer->recorder != NULL && tracer->socket != NULL &&
+        tracer_hup_is_abnormal(connection, events)) {
+        char reason[64];
+        snprintf(reason, sizeof reason, "instance %d hung up abnormally", instance->id);
+        if (instance->worker != NULL)
+            tracer_worker_pool_request_dump(tracer->workers, reason);
+        else
+            tracer_recorder_dump(tracer->recorder, reason);
+    }
+
+    instance->hup = 1;
+    wl_list_remove(&instance->link);
+    if (instance->worker != NULL)
+        wl_list_insert(&instance->worker->hup_list, &instance->link);
+    else
+        wl_list_insert(&tracer->hup_list, &instance->link);
+}
+
 static void
-tracer_handle_hup(struct tracer_connection *connection)
+tracer_release_hup(struct wl_list *hup_list)
 {
-    tracer_instance_destroy(connection->instance);
+    struct tracer_instance *instance, *next;
+
+    wl_list_for_each_safe(instance, next, hup_list, link)
+        tracer_instance_destroy(instance);
 }
 
 /**************************************************************************************************/
 
-static void
-tracer_handle_data(struct tracer_connection *connection)
+// Read once and queue the complete messages for the peer, returns the result of
+// wl_connection_read() and sets *count to the number of messages
+static int
+tracer_handle_read(struct tracer_connection *connection, int *count)
 {
     struct tracer *tracer = connection->instance->tracer;
-    struct tracer_connection *peer = connection->peer;
+    struct tracer_instance *instance = connection->instance;
+
+    // one timestamp for all the messages of the read, they stay in the tracer until the flush
+    instance->time = tracer_monotonic_time();
 
     // read data on the wire
     int total = wl_connection_read(connection->wl_conn);
 
-    struct tracer_instance *instance = connection->instance;
-    tracer_log("==================================================\n");
-    tracer_log("    \x1b[31mReceived %u bytes\x1b[0m\n", total);
+    // nothing read: EAGAIN ending a wakeup in edge-triggered mode, an error or the end of the
+    // stream, left to the caller
+    *count = 0;
+    if (total <= 0)
+        return total;
+
+    // records are formatted when decoded, and the banners are noise when messages are filtered
+    // or only counted
+    int text = tracer->frontend != &tracer_frontend_record && tracer->filter == NULL &&
+        tracer->stats == NULL;
+    if (text) {
+        tracer_log("==================================================\n");
+        tracer_log("    \x1b[31mReceived %u bytes\x1b[0m\n", total);
+    }
 
     // buffer can contain more than one message
     int size;
     for (int remain = total; remain >= 8; remain -= size) {
-        tracer_log("      \x1b[36mprocess message @%u \x1b[0m\n", remain);
+        if (text)
+            tracer_log("      \x1b[36mprocess message @%u \x1b[0m\n", remain);
         size = tracer->frontend->data(connection, remain);
         if (size == 0)
             break;
+        (*count)++;
     }
-    wl_connection_flush(peer->wl_conn);
-}
 
-/**************************************************************************************************/
+    return total;
+}
 
-// handle a new client ???
+// The messages read from connection have left the tracer up to what its peer was sent, their
+// transit ends there for --latency
 static void
-tracer_handle_client(struct tracer *tracer)
+tracer_transit_sent(struct tracer_connection *connection)
 {
-    struct tracer_socket *s = tracer->socket;
-    struct sockaddr_un name;
-    socklen_t length;
-    int clientfd;
-
-    length = sizeof name;
-    clientfd = wl_os_accept_cloexec(s->fd, (struct sockaddr *) &name, &length);
+    struct tracer_instance *instance = connection->instance;
 
-    if (clientfd < 0)
-        fprintf(stderr, "failed to accept(): %m\n");
-    else if (tracer_instance_create(tracer, clientfd) < 0) {
-        fprintf(stderr, "failed to create instance\n");
-        close(clientfd);
-    }
+    if (instance->latency != NULL)
+        tracer_latency_sent(instance->latency, connection->side,
+                            connection->peer->wl_conn->out_sent);
 }
 
-/**************************************************************************************************/
-/**************************************************************************************************/
-
-static struct tracer *
-tracer_create(struct tracer_options *options)
+// Send what the reads queued for the peer. What the socket does not take now is sent on EPOLLOUT,
+// a broken socket hangs up.
+static void
+tracer_handle_flush(struct tracer_connection *connection)
 {
-    int rc;
-    int socket_pair[2];
+    wl_connection_flush(connection->peer->wl_conn);
+    tracer_transit_sent(connection);
+}
 
-    struct tracer *tracer = malloc(sizeof *tracer);
-    if (tracer == NULL) {
-        errno = ENOMEM;
-        return NULL;
-    }
+// Level-triggered, a wakeup reads once. Edge-triggered, there is no other wakeup until the socket
+// is drained: read until EAGAIN, unless the connection gets paused or its read budget runs out. It
+// is then put on the ready list of its thread and read again after the next epoll_wait(), which
+// does not block meanwhile, so the busy connections take turns.
+//
+// The peer is flushed once per wakeup, with one sendmsg unless the output reaches the high
+// watermark, the socket is full or more than MAX_FDS_OUT fds are queued.
+static int
+tracer_handle_data(struct tracer_connection *connection)
+{
+    struct tracer_instance *instance = connection->instance;
+    struct tracer_connection *peer = connection->peer;
+    const struct tracer_options *options = instance->tracer->options;
+    struct wl_list *ready_list =
+        instance->worker != NULL ? &instance->worker->ready_list : &instance->tracer->ready_list;
+    int total, count;
+    size_t done = 0;
 
-    tracer->options = options;
+    peer->wl_conn->cork = options->edge_triggered;
+    for (;;) {
+        total = tracer_handle_read(connection, &count);
+        // the messages leave the tracer once the peer was sent the last byte of the read
+        if (count != 0 && instance->latency != NULL)
+            tracer_latency_read(instance->latency, connection->side, instance->time,
+                                peer->wl_conn->out_sent +
+                                wl_connection_pending_output(peer->wl_conn), count);
+
+        if (wl_connection_pending_output(peer->wl_conn) >= connection->high_watermark)
+            tracer_handle_flush(connection);
+        tracer_connection_update(connection);
+
+        if (!options->edge_triggered || total <= 0 || connection->paused)
+            break;
 
-    if (options->outfile != NULL) {
-        tracer->outfp = fopen(options->outfile, "w");
-        if (tracer->outfp == NULL) {
-            fprintf(stderr, "Failed to open output file %s: %m\n", options->outfile);
-            exit(EXIT_FAILURE);
+        done += total;
+        if (done >= options->read_budget) {
+            connection->ready = 1;
+            wl_list_insert(ready_list->prev, &connection->ready_link);
+            break;
         }
     }
-    else
-        tracer->outfp = stdout;
-
-    wl_list_init(&tracer->instance_list);
-    tracer->next_id = 0;
-    tracer->frontend_data = NULL;
 
-    if (options->output_format == TRACER_OUTPUT_INTERPRET)
-        tracer->frontend = &tracer_frontend_analyze;
-    else
-        tracer->frontend = &tracer_frontend_bin;
+    peer->wl_conn->cork = 0;
+    tracer_handle_flush(connection);
+    tracer_connection_update(connection);
+    tracer_connection_update(peer);
 
-    rc = tracer->frontend->init(tracer);
-    if (rc != 0) {
-        fprintf(stderr, "Failed to init tracer frontend\n");
-        exit(EXIT_FAILURE);
-    }
+    return total;
+}
+
+// A connection which hung up with data left forwards it as the peer takes it, one read at a time
+// while the output stays under the low watermark; its hangup is handled once everything is sent.
+static void
+tracer_connection_drain(struct tracer_connection *connection)
+{
+    struct wl_connection *out = connection->peer->wl_conn;
+    int total = 1;
+
+    while (total > 0 && !connection->ready &&
+           wl_connection_pending_output(out) <= connection->low_watermark)
+        total = tracer_handle_data(connection);
+
+    if (total <= 0 && wl_connection_pending_output(out) == 0)
+        tracer_handle_hup(connection, EPOLLHUP);
+}
+
+static void
+tracer_handle_writable(struct tracer_connection *connection)
+{
+    wl_connection_flush(connection->wl_conn);
+    tracer_transit_sent(connection->peer);
+    tracer_connection_update(connection);
+
+    if (connection->peer->closing)
+        tracer_connection_drain(connection->peer);
+    else
+        tracer_connection_update(connection->peer);
+}
+
+// Read again the connections whose budget ran out, with a new budget
+static void
+tracer_handle_ready(struct wl_list *ready_list)
+{
+    struct tracer_connection *connection, *next;
+    struct wl_list list;
+
+    if (wl_list_empty(ready_list))
+        return;
+
+    wl_list_init(&list);
+    wl_list_insert_list(&list, ready_list);
+    wl_list_init(ready_list);
+
+    wl_list_for_each_safe(connection, next, &list, ready_link) {
+        wl_list_remove(&connection->ready_link);
+        connection->ready = 0;
+        if (connection->instance->hup || connection->paused)
+            continue;
+        if (connection->closing)
+            tracer_connection_drain(connection);
+        else
+            tracer_handle_data(connection);
+    }
+}
+
+static void
+tracer_handle_event(struct tracer_connection *connection, uint32_t events)
+{
+    // instance hung up earlier in this batch
+    if (connection->instance->hup)
+        return;
+
+    if (events & EPOLLOUT)
+        tracer_handle_writable(connection);
+
+    if (events & EPOLLIN)
+        tracer_handle_data(connection);
+
+    if (connection->instance->hup)
+        return;
+
+    // the data already read, and what is left in the socket, still goes to the peer
+    if ((events & (EPOLLHUP | EPOLLERR)) == EPOLLHUP) {
+        tracer_connection_close(connection);
+        tracer_connection_drain(connection);
+    }
+    else if (events & EPOLLERR)
+        tracer_handle_hup(connection, events);
+}
+
+/**************************************************************************************************/
+
+// Accept all the pending clients, a session starting many clients at once needs one wakeup
+static void
+tracer_handle_client(struct tracer *tracer)
+{
+    struct tracer_socket *s = tracer->socket;
+    struct sockaddr_un name;
+    socklen_t length;
+    int clientfd;
+
+    for (;;) {
+        length = sizeof name;
+        clientfd = wl_os_accept_cloexec(s->fd, (struct sockaddr *) &name, &length);
+
+        if (clientfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                fprintf(stderr, "failed to accept(): %m\n");
+            break;
+        }
+
+        // the client socket is closed on failure
+        if (tracer_instance_create(tracer, clientfd) < 0)
+            fprintf(stderr, "failed to create instance: %m\n");
+
+        // the compositor may be back
+        s->pool_failed = 0;
+    }
+}
+
+// Connect the instances which found the backlog of the compositor full, in the order they were
+// accepted. An instance which can not connect is dropped, which hangs up its client.
+static void
+tracer_retry_connects(struct tracer *tracer)
+{
+    struct tracer_socket *s = tracer->socket;
+    struct tracer_instance *instance, *next;
+    int fd;
+
+    wl_list_for_each_safe(instance, next, &tracer->connect_list, link) {
+        fd = instance->server_conn->wl_conn->fd;
+        if (connect(fd, (struct sockaddr *) &s->upstream, s->upstream_size) < 0 &&
+            errno != EISCONN) {
+            // the next ones would find the backlog full too
+            if (errno == EAGAIN)
+                break;
+            fprintf(stderr, "failed to connect instance %d: %m\n", instance->id);
+            instance->hup = 1;
+            wl_list_remove(&instance->link);
+            wl_list_insert(&tracer->hup_list, &instance->link);
+            continue;
+        }
+
+        wl_list_remove(&instance->link);
+        tracer_instance_start(instance);
+    }
+}
+
+/**************************************************************************************************/
+
+// Buffers only shrink as they drain, a connection which goes quiet after a burst would keep them:
+// every TRACER_IDLE_SHRINK_MS, the empty buffers of the connections without traffic since the
+// previous pass get back to the default size
+static void
+tracer_shrink_idle(struct wl_list *instance_list, uint64_t *due)
+{
+    struct tracer_instance *instance;
+    uint64_t now = tracer_monotonic_time();
+
+    if (now < *due)
+        return;
+
+    wl_list_for_each(instance, instance_list, link) {
+        wl_connection_shrink_idle(instance->client_conn->wl_conn);
+        wl_connection_shrink_idle(instance->server_conn->wl_conn);
+    }
+    *due = now + TRACER_IDLE_SHRINK_MS * 1000000ULL;
+}
+
+// Timeout of epoll_wait() bounded by the next pass of tracer_shrink_idle()
+static int
+tracer_idle_timeout(uint64_t due, int timeout)
+{
+    uint64_t now = tracer_monotonic_time();
+    int left = now >= due ? 0 : (due - now + 999999) / 1000000;
+
+    return timeout >= 0 && timeout < left ? timeout : left;
+}
+
+/**************************************************************************************************/
+
+// Event loop of a worker thread
+static void *
+tracer_worker_run(void *data)
+{
+    struct tracer_worker *worker = data;
+    struct epoll_event events[TRACER_MAX_EVENTS];
+    struct tracer_instance *instance;
+    struct wl_list incoming;
+    int i, nfds, stop = 0;
+
+    while (!stop) {
+        nfds = epoll_wait(worker->epollfd, events, ARRAY_LENGTH(events),
+                          tracer_idle_timeout(worker->idle_due,
+                                              wl_list_empty(&worker->ready_list) ? -1 : 0));
+
+        if (nfds < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Failed to poll: %m\n");
+            break;
+        }
+
+        tracer_worker_begin_batch(worker);
+
+        for (i = 0; i < nfds; i++) {
+            // new instances from the main thread
+            if (events[i].data.ptr == worker) {
+                wl_list_init(&incoming);
+                tracer_worker_take_incoming(worker, &incoming, &stop);
+                wl_list_for_each(instance, &incoming, link) {
+                    tracer_connection_watch(instance->server_conn);
+                    tracer_connection_watch(instance->client_conn);
+                }
+                wl_list_insert_list(&worker->instance_list, &incoming);
+                continue;
+            }
+
+            tracer_handle_event(events[i].data.ptr, events[i].events);
+        }
+
+        tracer_handle_ready(&worker->ready_list);
+        tracer_release_hup(&worker->hup_list);
+        tracer_shrink_idle(&worker->instance_list, &worker->idle_due);
+        tracer_worker_end_batch(worker);
+    }
+
+    return NULL;
+}
+
+// Spread the instances over worker threads, must be called once signals are blocked
+static int
+tracer_create_workers(struct tracer *tracer, int count)
+{
+    tracer->workers = tracer_worker_pool_create(tracer, count);
+    if (tracer->workers == NULL)
+        return -1;
+
+    if (tracer_epoll_add_fd(tracer, tracer->workers->timerfd, tracer->workers) < 0)
+        return -1;
+
+    return tracer_worker_pool_start(tracer->workers, tracer_worker_run);
+}
+
+/**************************************************************************************************/
+/**************************************************************************************************/
+
+// With asynchronous output the forwarding thread only pushes the raw records to a queue, a writer
+// thread decodes them with its own instances and owns the writer
+struct tracer_async
+{
+    pthread_t thread;
+    struct tracer *decoder;
+};
+
+static void *
+tracer_async_run(void *data)
+{
+    struct tracer *tracer = data;
+    struct tracer *decoder = tracer->async->decoder;
+    char *record = NULL;
+    size_t capacity = 0;
+    uint64_t dropped, reported = 0;
+    uint32_t size;
+
+    do {
+        while ((size = tracer_queue_pop(tracer->queue, &record, &capacity)) > 0) {
+            if (tracer_record_decode_one(decoder, record, size) < 0)
+                fprintf(stderr, "Corrupted record in the output queue\n");
+            if (tracer->options->flush_each_message)
+                tracer_writer_flush(tracer->writer);
+        }
+
+        dropped = tracer_queue_dropped(tracer->queue);
+        if (dropped != reported) {
+            tracer_print(decoder, "\x1b[31m[%" PRIu64 " records dropped]\x1b[0m\n",
+                         dropped - reported);
+            reported = dropped;
+        }
+
+        // write out what is buffered before sleeping
+        tracer_writer_flush(tracer->writer);
+    } while (tracer_queue_wait(tracer->queue));
+
+    free(record);
+
+    return NULL;
+}
+
+// Create the queue and the decoder of the writer thread, before the record frontend is initialized
+static int
+tracer_create_async(struct tracer *tracer)
+{
+    struct tracer_options *options = tracer->options;
+    struct tracer_async *async;
+    struct tracer *decoder;
+
+    async = calloc(1, sizeof *async);
+    decoder = calloc(1, sizeof *decoder);
+    if (async == NULL || decoder == NULL) {
+        free(async);
+        free(decoder);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    decoder->options = options;
+    wl_list_init(&decoder->instance_list);
+    wl_list_init(&decoder->hup_list);
+    decoder->outfp = tracer->outfp;
+    decoder->writer = tracer->writer;
+    // the records are timed by the forwarding thread
+    decoder->time_offset = tracer->time_offset;
+    decoder->frontend = &tracer_frontend_analyze;
+    if (decoder->frontend->init(decoder) != 0)
+        return -1;
+
+    tracer->queue = tracer_queue_create(TRACER_QUEUE_DEFAULT_SIZE, options->async_policy);
+    if (tracer->queue == NULL)
+        return -1;
+
+    async->decoder = decoder;
+    tracer->async = async;
+
+    return 0;
+}
+
+// Must be called once signals are blocked, the thread inherits the mask
+static int
+tracer_start_async(struct tracer *tracer)
+{
+    errno = pthread_create(&tracer->async->thread, NULL, tracer_async_run, tracer);
+
+    return errno == 0 ? 0 : -1;
+}
+
+// Let the writer thread drain the queue, then join it
+static void
+tracer_stop_async(struct tracer *tracer)
+{
+    uint64_t dropped;
+
+    tracer_queue_close(tracer->queue);
+    pthread_join(tracer->async->thread, NULL);
+
+    dropped = tracer_queue_dropped(tracer->queue);
+    if (dropped != 0)
+        fprintf(stderr, "%" PRIu64 " records dropped, the output was too slow\n", dropped);
+}
+
+/**************************************************************************************************/
+/**************************************************************************************************/
+
+// Signals are received through a signalfd, so they are handled from the event loop
+static int
+tracer_create_signalfd(struct tracer *tracer)
+{
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+        return -1;
+
+    tracer->signalfd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (tracer->signalfd < 0)
+        return -1;
+
+    return tracer_epoll_add_fd(tracer, tracer->signalfd, &tracer->signalfd);
+}
+
+// Return the signal number, 0 if none is pending
+static int
+tracer_handle_signal(struct tracer *tracer)
+{
+    struct signalfd_siginfo info;
+
+    if (read(tracer->signalfd, &info, sizeof info) != sizeof info)
+        return 0;
+
+    return info.ssi_signo;
+}
+
+// Reap the child, dump the flight recorder if it was killed or failed
+static void
+tracer_handle_child(struct tracer *tracer, int options)
+{
+    char reason[64];
+    int status;
+
+    if (tracer->child_pid <= 0 || waitpid(tracer->child_pid, &status, options) != tracer->child_pid)
+        return;
+
+    tracer->child_pid = 0;
+
+    if (WIFSIGNALED(status))
+        snprintf(reason, sizeof reason, "client killed by signal %d", WTERMSIG(status));
+    else if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+        snprintf(reason, sizeof reason, "client exited with status %d", WEXITSTATUS(status));
+    else
+        return;
+
+    if (tracer->recorder != NULL)
+        tracer_recorder_dump(tracer->recorder, reason);
+}
+
+// The child closes its socket before it becomes a zombie, give it a moment to exit
+static void
+tracer_wait_child(struct tracer *tracer)
+{
+    struct timespec timeout = { 0, 100 * 1000000L };
+    sigset_t mask;
+
+    tracer_handle_child(tracer, WNOHANG);
+    if (tracer->child_pid <= 0 || tracer->recorder == NULL)
+        return;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigtimedwait(&mask, NULL, &timeout);
+    tracer_handle_child(tracer, WNOHANG);
+}
+
+/**************************************************************************************************/
+/**************************************************************************************************/
+
+static struct tracer *
+tracer_create(struct tracer_options *options)
+{
+    int rc;
+    int socket_pair[2];
+
+    struct tracer *tracer = malloc(sizeof *tracer);
+    if (tracer == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    tracer->options = options;
+
+    if (options->outfile != NULL) {
+        tracer->outfp = fopen(options->outfile, "w");
+        if (tracer->outfp == NULL) {
+            fprintf(stderr, "Failed to open output file %s: %m\n", options->outfile);
+            exit(EXIT_FAILURE);
+        }
+    }
+    else
+        tracer->outfp = stdout;
+
+    tracer->writer = tracer_writer_create(fileno(tracer->outfp), TRACER_WRITER_SIZE);
+    if (tracer->writer == NULL) {
+        fprintf(stderr, "Failed to create output writer: %m\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // one offset for the whole run, shared by the output, the binary traces and the dumps
+    tracer->time_offset = tracer_clock_realtime_offset();
+
+    tracer->recorder = NULL;
+    if (options->recorder_file != NULL) {
+        tracer->recorder = tracer_recorder_create(options->recorder_file, options->recorder_size,
+                                                  options->mode, tracer->time_offset,
+                                                  options->recorder_dumps);
+        if (tracer->recorder == NULL) {
+            fprintf(stderr, "Failed to create flight recorder %s: %m\n", options->recorder_file);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    wl_list_init(&tracer->instance_list);
+    wl_list_init(&tracer->hup_list);
+    wl_list_init(&tracer->ready_list);
+    wl_list_init(&tracer->connect_list);
+    tracer->next_id = 0;
+    tracer->idle_due = 0;
+    tracer->child_pid = 0;
+    tracer->workers = NULL;
+    tracer->queue = NULL;
+    tracer->async = NULL;
+    tracer->frontend_data = NULL;
+    tracer->filter = NULL;
+    tracer->stats = NULL;
+    tracer->latency = NULL;
+
+    if (options->async && tracer_create_async(tracer) < 0) {
+        fprintf(stderr, "Failed to create asynchronous output: %m\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (options->format == TRACER_FORMAT_BINARY || options->async)
+        tracer->frontend = &tracer_frontend_record;
+    else if (options->output_format == TRACER_OUTPUT_INTERPRET)
+        tracer->frontend = &tracer_frontend_analyze;
+    else
+        tracer->frontend = &tracer_frontend_bin;
+
+    rc = tracer->frontend->init(tracer);
+    if (rc != 0) {
+        fprintf(stderr, "Failed to init tracer frontend\n");
+        exit(EXIT_FAILURE);
+    }
 
     // Spawn child if we're in single mode
     // compositor <=> tracer <=> client
@@ -601,6 +1552,7 @@ tracer_create(struct tracer_options *options)
             fprintf(stderr, "Failed to fork: %m\n");
             goto err_fork;
         }
+        tracer->child_pid = pid;
 
     }
 
@@ -612,6 +1564,23 @@ tracer_create(struct tracer_options *options)
         goto err_epoll_create;
     }
 
+    // flush the output periodically and before exiting on a signal, the writer thread flushes
+    // it itself
+    if (tracer->async == NULL)
+        tracer_epoll_add_fd(tracer, tracer->writer->timerfd, tracer->writer);
+    if (tracer_create_signalfd(tracer) < 0) {
+        fprintf(stderr, "Failed to create signalfd: %m\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (tracer->stats != NULL)
+        tracer_epoll_add_fd(tracer, tracer->stats->timerfd, tracer->stats);
+
+    if (tracer->async != NULL && tracer_start_async(tracer) < 0) {
+        fprintf(stderr, "Failed to create writer thread: %m\n");
+        exit(EXIT_FAILURE);
+    }
+
     if (options->mode == TRACER_MODE_SINGLE) {
         close(socket_pair[1]); // used by child
         rc = tracer_instance_create(tracer, socket_pair[0]);
@@ -621,9 +1590,14 @@ tracer_create(struct tracer_options *options)
         }
     }
     else {
-        rc = tracer_create_socket(tracer, "wayland-1");
+        rc = tracer_create_socket(tracer, options->socket);
         if (rc < 0)
             exit(EXIT_FAILURE);
+
+        if (options->workers > 0 && tracer_create_workers(tracer, options->workers) < 0) {
+            fprintf(stderr, "Failed to create worker threads: %m\n");
+            exit(EXIT_FAILURE);
+        }
     }
 
     return tracer;
@@ -656,40 +1630,151 @@ tracer_create(struct tracer_options *options)
 
 /**************************************************************************************************/
 
+// Render a binary trace file
+//   called from main
+static int
+tracer_decode(struct tracer_options *options)
+{
+    struct tracer *tracer;
+    int rc;
+
+    if (options->output_format != TRACER_OUTPUT_INTERPRET) {
+        fprintf(stderr, "Decoding a trace requires protocol files, see -d\n");
+        return -1;
+    }
+
+    tracer = calloc(1, sizeof *tracer);
+    if (tracer == NULL)
+        return -1;
+
+    tracer->options = options;
+    wl_list_init(&tracer->instance_list);
+    wl_list_init(&tracer->hup_list);
+    wl_list_init(&tracer->ready_list);
+    wl_list_init(&tracer->connect_list);
+
+    if (options->outfile != NULL) {
+        tracer->outfp = fopen(options->outfile, "w");
+        if (tracer->outfp == NULL) {
+            fprintf(stderr, "Failed to open output file %s: %m\n", options->outfile);
+            return -1;
+        }
+    }
+    else
+        tracer->outfp = stdout;
+
+    tracer->writer = tracer_writer_create(fileno(tracer->outfp), TRACER_WRITER_SIZE);
+    if (tracer->writer == NULL) {
+        fprintf(stderr, "Failed to create output writer: %m\n");
+        return -1;
+    }
+
+    tracer->frontend = &tracer_frontend_analyze;
+    if (tracer->frontend->init(tracer) != 0) {
+        fprintf(stderr, "Failed to init tracer frontend\n");
+        return -1;
+    }
+
+    rc = tracer_record_decode(tracer, options->decode_file);
+    tracer_writer_flush(tracer->writer);
+
+    return rc;
+}
+
+/**************************************************************************************************/
+
 // Tracer event loop
 //   called from main
 static int
 tracer_run(struct tracer *tracer)
 {
-    struct epoll_event ev;
+    struct epoll_event events[TRACER_MAX_EVENTS];
     struct tracer_connection *connection;
-    int nfds;
+    int i, nfds, signo, timeout;
 
     // event loop
     for (;;) {
-        // Wait for a new event
-        nfds = epoll_wait(tracer->epollfd, &ev, 1, -1);
+        // Wait for new events, all the ready fds are returned at once
+        if (!wl_list_empty(&tracer->ready_list))
+            timeout = 0;
+        else if (!wl_list_empty(&tracer->connect_list))
+            timeout = TRACER_CONNECT_RETRY_MS;
+        else
+            timeout = tracer_pool_timeout(tracer->socket);
+        timeout = tracer_idle_timeout(tracer->idle_due, timeout);
+        nfds = epoll_wait(tracer->epollfd, events, ARRAY_LENGTH(events), timeout);
 
         if (nfds < 0) {
+            if (errno == EINTR)
+                continue;
             fprintf(stderr, "Failed to poll: %m\n");
             return -1;
         }
 
-        // event can comes from the compositor and the client
-        connection = (struct tracer_connection *) ev.data.ptr;
+        for (i = 0; i < nfds; i++) {
+            // event can comes from the compositor and the client
+            connection = (struct tracer_connection *) events[i].data.ptr;
 
-        if (ev.events & EPOLLIN) {
-            // server mode ???
-            if (connection == NULL)
-                tracer_handle_client(tracer);
-            else
-                tracer_handle_data(connection);
+            // server mode: new client on the listening socket
+            if (connection == NULL) {
+                if (events[i].events & EPOLLIN)
+                    tracer_handle_client(tracer);
+                continue;
+            }
+
+            if (events[i].data.ptr == tracer->writer) {
+                tracer_writer_handle_timer(tracer->writer);
+                continue;
+            }
+
+            if (tracer->stats != NULL && events[i].data.ptr == tracer->stats) {
+                tracer_stats_handle_timer(tracer);
+                continue;
+            }
+
+            if (tracer->workers != NULL && events[i].data.ptr == tracer->workers) {
+                tracer_worker_pool_handle_timer(tracer->workers);
+                continue;
+            }
+
+            if (events[i].data.ptr == &tracer->signalfd) {
+                signo = tracer_handle_signal(tracer);
+                if (signo == SIGUSR1) {
+                    if (tracer->workers != NULL)
+                        tracer_worker_pool_merge(tracer->workers, 0);
+                    if (tracer->recorder != NULL)
+                        tracer_recorder_dump(tracer->recorder, "SIGUSR1");
+                    if (tracer->stats != NULL)
+                        tracer_stats_report(tracer);
+                }
+                else if (signo == SIGCHLD) {
+                    tracer_handle_child(tracer, WNOHANG);
+                }
+                else if (signo != 0) {
+                    fprintf(stderr, "Caught signal %d, exiting\n", signo);
+                    if (tracer->workers != NULL)
+                        tracer_worker_pool_stop(tracer->workers);
+                    return 0;
+                }
+                continue;
+            }
+
+            tracer_handle_event(connection, events[i].events);
         }
 
-        if (ev.events & EPOLLHUP) {
-            tracer_handle_hup(connection);
+        if (!wl_list_empty(&tracer->connect_list))
+            tracer_retry_connects(tracer);
+        else if (tracer_pool_timeout(tracer->socket) == 0)
+            tracer_pool_refill(tracer->socket);
+
+        tracer_handle_ready(&tracer->ready_list);
+        tracer_shrink_idle(&tracer->instance_list, &tracer->idle_due);
+
+        if (!wl_list_empty(&tracer->hup_list)) {
+            tracer_release_hup(&tracer->hup_list);
 
             if (tracer->socket == NULL) {
+                tracer_wait_child(tracer);
                 fprintf(stderr, "Child hups, exiting\n");
                 break;
             }
@@ -719,6 +1804,106 @@ tracer_add_protocol(struct tracer_options *options, const char *file)
     return 0;
 }
 
+struct protocol_dir_files
+{
+    char **paths;
+    int count, capacity;
+};
+
+static int
+tracer_compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+// Collect the xml files under dir
+static int
+tracer_scan_protocol_dir(struct protocol_dir_files *files, const char *dir)
+{
+    struct dirent *entry;
+    struct stat st;
+    size_t len;
+    char *path;
+    DIR *d;
+
+    d = opendir(dir);
+    if (d == NULL) {
+        fprintf(stderr, "Failed to open protocol directory %s: %m\n", dir);
+        return -1;
+    }
+
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        len = strlen(dir) + strlen(entry->d_name) + 2;
+        path = malloc(len);
+        if (path == NULL) {
+            closedir(d);
+            return -1;
+        }
+        snprintf(path, len, "%s/%s", dir, entry->d_name);
+
+        if (stat(path, &st) < 0) {
+            free(path);
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            int rc = tracer_scan_protocol_dir(files, path);
+            free(path);
+            if (rc < 0) {
+                closedir(d);
+                return -1;
+            }
+            continue;
+        }
+
+        len = strlen(entry->d_name);
+        if (!S_ISREG(st.st_mode) || len < 4 || strcmp(entry->d_name + len - 4, ".xml") != 0) {
+            free(path);
+            continue;
+        }
+
+        if (files->count == files->capacity) {
+            int capacity = files->capacity == 0 ? 64 : files->capacity * 2;
+            char **paths = realloc(files->paths, capacity * sizeof *paths);
+            if (paths == NULL) {
+                free(path);
+                closedir(d);
+                return -1;
+            }
+            files->paths = paths;
+            files->capacity = capacity;
+        }
+        files->paths[files->count++] = path;
+    }
+
+    closedir(d);
+
+    return 0;
+}
+
+// Add all the xml files under dir, sorted so the order does not depend on the file system
+static int
+tracer_add_protocol_dir(struct tracer_options *options, const char *dir)
+{
+    struct protocol_dir_files files = { NULL, 0, 0 };
+    int i;
+
+    if (tracer_scan_protocol_dir(&files, dir) < 0)
+        return -1;
+
+    qsort(files.paths, files.count, sizeof *files.paths, tracer_compare_paths);
+    for (i = 0; i < files.count; i++) {
+        if (tracer_add_protocol(options, files.paths[i]) != 0)
+            return -1;
+    }
+    free(files.paths);
+
+    return 0;
+}
+
 /**************************************************************************************************/
 /**************************************************************************************************/
 
@@ -727,15 +1912,55 @@ usage(void)
 {
     fprintf(stderr, "wayland-tracer: a wayland protocol dumper\n"
             "Usage:\twayland-tracer [OPTIONS] -- file ...\n"
-            "\twayland-tracer -S NAME [OPTIONS]\n\n"
+            "\twayland-tracer -S NAME [OPTIONS]\n"
+            "\twayland-tracer --decode FILE -d FILE [OPTIONS]\n\n"
             "Options:\n\n"
             "  -S NAME\t\tMake wayland-tracer run under server mode\n"
             "\t\t\tand make the name of server socket NAME (such as\n"
             "\t\t\twayland-0)\n"
+            "  -j N\t\t\tServer mode: handle the clients on N worker threads\n"
+            "  --upstream-pool N\tServer mode: keep N connections to the compositor\n"
+            "\t\t\tready for the next clients\n"
             "  -o FILE\t\tDump output to FILE\n"
+            "  -u\t\t\tFlush the output after every message\n"
+            "  --clock SOURCE\t\tSource of the timestamps: monotonic (default) or\n"
+            "\t\t\ttsc, the calibrated x86-64 time-stamp counter\n"
+            "  -A POLICY\t\tFormat the output on a writer thread, requires -d\n"
+            "\t\t\tPOLICY for a full queue: drop or block\n"
+            "  -F FORMAT\t\tOutput format: text (default) or binary\n"
+            "\t\t\tbinary writes the raw messages, see --decode\n"
+            "  --decode FILE\t\tRender the binary trace FILE, requires -d\n"
+            "  -R FILE\t\tKeep the latest messages in the flight recorder FILE\n"
+            "\t\t\tinstead of writing them, dumped as a binary trace\n"
+            "\t\t\ton SIGUSR1 or when a client exits abnormally\n"
+            "  --recorder-size SIZE\tSize in bytes of the flight recorder\n"
+            "\t\t\t(default 67108864, at least the -B size plus 4 KiB)\n"
+            "  --recorder-dumps N\tNumber of flight recorder dumps kept, the older\n"
+            "\t\t\tones are removed (default 8, 0 keeps them all)\n"
+            "  -B SIZE\t\tMaximum size in bytes of a connection buffer\n"
+            "\t\t\t(default 1048576, rounded up to a power of two)\n"
+            "  --edge-triggered\tRead each connection until EAGAIN per wakeup\n"
+            "  --read-budget SIZE\tBytes read per wakeup before the other connections\n"
+            "\t\t\tget a turn, implies --edge-triggered (default 262144)\n"
             "  -d FILE\t\tAdd an xml protocol file\n"
             "\t\t\twayland-tracer will output readable format according\n"
-            "\t\t\tto the protocols given if -d is specified\n" "  -h\t\t\tThis help message\n\n");
+            "\t\t\tto the protocols given if -d is specified\n"
+            "  -D DIR\t\tAdd all the xml protocol files under DIR\n"
+            "  -W\t\t\tAdd the protocols of wayland-protocols\n"
+            "\t\t\t(" WAYLAND_PROTOCOLS_DATADIR ")\n"
+            "  --filter RULE\t\tOnly show the messages matching RULE, requires -d\n"
+            "\t\t\tRULE is [QUALIFIER:]...GLOB, GLOB is matched against\n"
+            "\t\t\tinterface.message, QUALIFIER is request, event or\n"
+            "\t\t\tan instance id\n"
+            "  --exclude RULE\t\tDo not show the messages matching RULE\n"
+            "  --stats\t\tOnly count the messages, print the busiest ones\n"
+            "\t\t\tevery second and on SIGUSR1, requires -d\n"
+            "  --stats-top N\t\tNumber of rows of the statistics (default 10)\n"
+            "  --latency\t\tMeasure the time messages spend in the tracer and\n"
+            "\t\t\tthe callback round-trips, requires -d\n"
+            "  --latency-json FILE\tAlso write the latency histograms to FILE\n"
+            "  --no-cache\t\tAlways parse the protocol files, do not use\n"
+            "\t\t\tor update the protocol cache\n" "  -h\t\t\tThis help message\n\n");
 }
 
 /**************************************************************************************************/
@@ -753,9 +1978,30 @@ tracer_parse_args(int argc, char *argv[])
     }
 
     options->spawn_args = NULL;
+    options->outfile = NULL;
+    options->flush_each_message = 0;
+    options->protocol_cache = 1;
+    options->workers = 0;
+    options->upstream_pool = 0;
+    options->recorder_file = NULL;
+    options->recorder_size = TRACER_RECORDER_DEFAULT_SIZE;
+    options->recorder_dumps = TRACER_RECORDER_DEFAULT_DUMPS;
+    options->async = 0;
+    options->async_policy = TRACER_QUEUE_DROP;
+    options->format = TRACER_FORMAT_TEXT;
+    options->decode_file = NULL;
     options->mode = TRACER_MODE_SINGLE;
     wl_list_init(&options->protocol_file_list);
+    wl_list_init(&options->filter_rule_list);
+    options->stats = 0;
+    options->stats_top = TRACER_STATS_DEFAULT_TOP;
+    options->latency = 0;
+    options->latency_json = NULL;
+    options->clock = TRACER_CLOCK_MONOTONIC;
     options->output_format = TRACER_OUTPUT_RAW;
+    options->max_buffer_size = (size_t) 1 << WL_BUFFER_DEFAULT_MAX_SIZE_BITS;
+    options->edge_triggered = 0;
+    options->read_budget = TRACER_DEFAULT_READ_BUDGET;
 
     if (argc == 1) {
         usage();
@@ -793,6 +2039,201 @@ tracer_parse_args(int argc, char *argv[])
             }
             options->outfile = argv[i];
         }
+        else if (!strcmp(argv[i], "-F")) {
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "Output format not specified\n");
+                exit(EXIT_FAILURE);
+            }
+            if (!strcmp(argv[i], "text"))
+                options->format = TRACER_FORMAT_TEXT;
+            else if (!strcmp(argv[i], "binary"))
+                options->format = TRACER_FORMAT_BINARY;
+            else {
+                fprintf(stderr, "Unknown output format '%s'\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (!strcmp(argv[i], "--decode")) {
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "Trace file not specified\n");
+                exit(EXIT_FAILURE);
+            }
+            options->decode_file = argv[i];
+        }
+        else if (!strcmp(argv[i], "-j")) {
+            char *end;
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "Number of worker threads not specified\n");
+                exit(EXIT_FAILURE);
+            }
+            options->workers = strtol(argv[i], &end, 0);
+            if (*end != '\0' || options->workers < 0 || options->workers > TRACER_MAX_WORKERS) {
+                fprintf(stderr, "Invalid number of worker threads '%s', maximum is %d\n",
+                        argv[i], TRACER_MAX_WORKERS);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (!strcmp(argv[i], "--upstream-pool")) {
+            char *end;
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "Size of the upstream pool not specified\n");
+                exit(EXIT_FAILURE);
+            }
+            options->upstream_pool = strtol(argv[i], &end, 0);
+            if (*end != '\0' || options->upstream_pool < 0 ||
+                options->upstream_pool > TRACER_MAX_UPSTREAM_POOL) {
+                fprintf(stderr, "Invalid size of the upstream pool '%s', maximum is %d\n",
+                        argv[i], TRACER_MAX_UPSTREAM_POOL);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (!strcmp(argv[i], "-R")) {
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "Flight recorder file not specified\n");
+                exit(EXIT_FAILURE);
+            }
+            options->recorder_file = argv[i];
+        }
+        else if (!strcmp(argv[i], "--recorder-size")) {
+            char *end;
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "Flight recorder size not specified\n");
+                exit(EXIT_FAILURE);
+            }
+            options->recorder_size = strtoul(argv[i], &end, 0);
+            if (*end != '\0' || options->recorder_size < (1 << 16)) {
+                fprintf(stderr, "Invalid flight recorder size '%s', minimum is %d\n",
+                        argv[i], 1 << 16);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (!strcmp(argv[i], "--recorder-dumps")) {
+            char *end;
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "Number of flight recorder dumps not specified\n");
+                exit(EXIT_FAILURE);
+            }
+            options->recorder_dumps = strtol(argv[i], &end, 0);
+            if (*end != '\0' || options->recorder_dumps < 0 ||
+                options->recorder_dumps > TRACER_RECORDER_MAX_DUMPS) {
+                fprintf(stderr, "Invalid number of flight recorder dumps '%s', maximum is %d\n",
+                        argv[i], TRACER_RECORDER_MAX_DUMPS);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (!strcmp(argv[i], "--filter") || !strcmp(argv[i], "--exclude")) {
+            int exclude = !strcmp(argv[i], "--exclude");
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "Filter rule not specified\n");
+                exit(EXIT_FAILURE);
+            }
+            if (tracer_filter_add_rule(&options->filter_rule_list, argv[i], exclude) != 0)
+                exit(EXIT_FAILURE);
+        }
+        else if (!strcmp(argv[i], "--stats")) {
+            options->stats = 1;
+        }
+        else if (!strcmp(argv[i], "--stats-top")) {
+            char *end;
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "Number of rows not specified\n");
+                exit(EXIT_FAILURE);
+            }
+            options->stats_top = strtol(argv[i], &end, 0);
+            if (*end != '\0' || options->stats_top < 1 || options->stats_top > 1000) {
+                fprintf(stderr, "Invalid number of rows '%s', between 1 and 1000\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (!strcmp(argv[i], "--latency")) {
+            options->latency = 1;
+        }
+        else if (!strcmp(argv[i], "--latency-json")) {
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "Latency report file not specified\n");
+                exit(EXIT_FAILURE);
+            }
+            options->latency = 1;
+            options->latency_json = argv[i];
+        }
+        else if (!strcmp(argv[i], "--no-cache")) {
+            options->protocol_cache = 0;
+        }
+        else if (!strcmp(argv[i], "-u")) {
+            options->flush_each_message = 1;
+        }
+        else if (!strcmp(argv[i], "--clock")) {
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "Clock source not specified\n");
+                exit(EXIT_FAILURE);
+            }
+            if (!strcmp(argv[i], "monotonic"))
+                options->clock = TRACER_CLOCK_MONOTONIC;
+            else if (!strcmp(argv[i], "tsc"))
+                options->clock = TRACER_CLOCK_TSC;
+            else {
+                fprintf(stderr, "Unknown clock source '%s'\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (!strcmp(argv[i], "-A")) {
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "Queue policy not specified\n");
+                exit(EXIT_FAILURE);
+            }
+            if (!strcmp(argv[i], "drop"))
+                options->async_policy = TRACER_QUEUE_DROP;
+            else if (!strcmp(argv[i], "block"))
+                options->async_policy = TRACER_QUEUE_BLOCK;
+            else {
+                fprintf(stderr, "Unknown queue policy '%s'\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            options->async = 1;
+        }
+        else if (!strcmp(argv[i], "-B")) {
+            char *end;
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "Buffer size not specified\n");
+                exit(EXIT_FAILURE);
+            }
+            options->max_buffer_size = strtoul(argv[i], &end, 0);
+            if (*end != '\0' || options->max_buffer_size < (1 << WL_BUFFER_DEFAULT_SIZE_BITS)) {
+                fprintf(stderr, "Invalid buffer size '%s', minimum is %d\n",
+                        argv[i], 1 << WL_BUFFER_DEFAULT_SIZE_BITS);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (!strcmp(argv[i], "--edge-triggered")) {
+            options->edge_triggered = 1;
+        }
+        else if (!strcmp(argv[i], "--read-budget")) {
+            char *end;
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "Read budget not specified\n");
+                exit(EXIT_FAILURE);
+            }
+            options->read_budget = strtoul(argv[i], &end, 0);
+            if (*end != '\0' || options->read_budget == 0) {
+                fprintf(stderr, "Invalid read budget '%s'\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            options->edge_triggered = 1;
+        }
         else if (!strcmp(argv[i], "-d")) {
             i++;
             if (i == argc) {
@@ -803,6 +2244,21 @@ tracer_parse_args(int argc, char *argv[])
                 exit(EXIT_FAILURE);
             options->output_format = TRACER_OUTPUT_INTERPRET;
         }
+        else if (!strcmp(argv[i], "-D")) {
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "Protocol directory not specified\n");
+                exit(EXIT_FAILURE);
+            }
+            if (tracer_add_protocol_dir(options, argv[i]) != 0)
+                exit(EXIT_FAILURE);
+            options->output_format = TRACER_OUTPUT_INTERPRET;
+        }
+        else if (!strcmp(argv[i], "-W")) {
+            if (tracer_add_protocol_dir(options, WAYLAND_PROTOCOLS_DATADIR) != 0)
+                exit(EXIT_FAILURE);
+            options->output_format = TRACER_OUTPUT_INTERPRET;
+        }
         else {
             fprintf(stderr, "Unknown argument '%s'\n", argv[i]);
             usage();
@@ -810,10 +2266,76 @@ tracer_parse_args(int argc, char *argv[])
         }
     }
 
-    if (options->mode == TRACER_MODE_SINGLE && options->spawn_args == NULL) {
+    if (options->decode_file == NULL &&
+        options->mode == TRACER_MODE_SINGLE && options->spawn_args == NULL) {
         fprintf(stderr, "No client specified in single mode\n");
         exit(EXIT_FAILURE);
     }
+
+    // filters apply to the decoded messages
+    if (!wl_list_empty(&options->filter_rule_list)) {
+        if (options->output_format != TRACER_OUTPUT_INTERPRET) {
+            fprintf(stderr, "Filtering requires protocol files, see -d\n");
+            exit(EXIT_FAILURE);
+        }
+        if (options->decode_file == NULL &&
+            (options->format != TRACER_FORMAT_TEXT || options->recorder_file != NULL)) {
+            fprintf(stderr, "--filter and --exclude can not be used with -F binary or -R,\n"
+                    "apply them with --decode instead\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // the counters are updated and reported by the main thread
+    if (options->stats) {
+        if (options->output_format != TRACER_OUTPUT_INTERPRET) {
+            fprintf(stderr, "Statistics require protocol files, see -d\n");
+            exit(EXIT_FAILURE);
+        }
+        if (options->decode_file != NULL || options->format != TRACER_FORMAT_TEXT ||
+            options->recorder_file != NULL || options->async || options->workers > 0) {
+            fprintf(stderr, "--stats can not be used with --decode, -F binary, -R, -A or -j\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // the histograms are updated on the forwarding path and reported by the main thread
+    if (options->latency) {
+        if (options->output_format != TRACER_OUTPUT_INTERPRET) {
+            fprintf(stderr, "Latency measurements require protocol files, see -d\n");
+            exit(EXIT_FAILURE);
+        }
+        if (options->decode_file != NULL || options->format != TRACER_FORMAT_TEXT ||
+            options->recorder_file != NULL || options->async || options->workers > 0) {
+            fprintf(stderr, "--latency can not be used with --decode, -F binary, -R, -A or -j\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // the writer thread decodes the records, text output only
+    if (options->async) {
+        if (options->output_format != TRACER_OUTPUT_INTERPRET) {
+            fprintf(stderr, "Asynchronous output requires protocol files, see -d\n");
+            exit(EXIT_FAILURE);
+        }
+        if (options->format != TRACER_FORMAT_TEXT || options->recorder_file != NULL ||
+            options->workers > 0) {
+            fprintf(stderr, "-A can not be used with -F binary, -R or -j\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // the flight recorder stores binary records, a record holds what one read brought in
+    if (options->recorder_file != NULL) {
+        size_t record_max = sizeof(struct tracer_record_header) +
+            wl_connection_max_input_size(options->max_buffer_size);
+        if (options->recorder_size < record_max) {
+            fprintf(stderr, "Flight recorder size %zu too small for -B %zu, minimum is %zu\n",
+                    options->recorder_size, options->max_buffer_size, record_max);
+            exit(EXIT_FAILURE);
+        }
+        options->format = TRACER_FORMAT_BINARY;
+    }
     return options;
 }
 
@@ -828,6 +2350,19 @@ main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
 
+    if (options->decode_file != NULL) {
+        if (tracer_decode(options) == 0)
+            exit(EXIT_SUCCESS);
+        else
+            exit(EXIT_FAILURE);
+    }
+
+    // before any thread reads the clock
+    if (tracer_clock_init(options->clock) < 0) {
+        fprintf(stderr, "No invariant TSC, using CLOCK_MONOTONIC\n");
+        tracer_clock_init(TRACER_CLOCK_MONOTONIC);
+    }
+
     struct tracer *tracer = tracer_create(options);
     if (tracer == NULL) {
         fprintf(stderr, "Failed to create tracer, exiting!\n");
@@ -836,6 +2371,16 @@ main(int argc, char *argv[])
 
     // Start event loop
     int rc = tracer_run(tracer);
+    if (tracer->stats != NULL)
+        tracer_stats_report(tracer);
+    if (tracer->latency != NULL)
+        tracer_latency_report(tracer);
+    if (tracer->async != NULL)
+        tracer_stop_async(tracer);
+    // finishes the dumps in progress
+    if (tracer->recorder != NULL)
+        tracer_recorder_destroy(tracer->recorder);
+    tracer_writer_flush(tracer->writer);
     if (rc == 0)
         exit(EXIT_SUCCESS);
     else
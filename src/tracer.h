@@ -23,9 +23,13 @@
 #ifndef TRACER_H
 #define TRACER_H
 
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <sys/types.h>
 
 #include "wayland-util.h"
+#include "tracer-objects.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -41,12 +45,26 @@ extern "C"
 #define TRACER_OUTPUT_RAW 0
 #define TRACER_OUTPUT_INTERPRET 1
 
+#define TRACER_FORMAT_TEXT 0
+#define TRACER_FORMAT_BINARY 1
+
 #define tracer_log(...) tracer_log_impl(instance, __VA_ARGS__)
 #define tracer_log_cont(...) tracer_log_cont_impl(instance, __VA_ARGS__)
 #define tracer_log_end() tracer_log_end_impl(instance)
 
 struct tracer;
 struct tracer_instance;
+struct tracer_writer;
+struct tracer_recorder;
+struct tracer_worker;
+struct tracer_worker_pool;
+struct tracer_queue;
+struct tracer_async;
+struct tracer_filter;
+struct tracer_stats;
+struct tracer_stats_counter;
+struct tracer_latency;
+struct tracer_latency_instance;
 
 struct tracer_connection
 {
@@ -54,12 +72,25 @@ struct tracer_connection
     struct tracer_connection *peer;
     struct tracer_instance *instance;
     int side;
+    // events the socket is watched for, EPOLLOUT only while output is queued
+    uint32_t events;
+    // reads stop when the output queued for the peer reaches the high watermark and resume once it
+    // is back to the low watermark, so a slow reader throttles the writer instead of losing data
+    uint32_t high_watermark, low_watermark;
+    int paused;
+    // hung up: no longer watched, the rest of its data is forwarded as the peer drains
+    int closing;
+    // edge-triggered: its read budget ran out before EAGAIN, on the ready list of its thread
+    struct wl_list ready_link;
+    int ready;
 };
 
 struct tracer_frontend_interface
 {
     int (*init)(struct tracer *);
     int (*data)(struct tracer_connection *, int);
+    // optional, called before an instance is destroyed
+    void (*destroy)(struct tracer_instance *);
 };
 
 struct tracer_instance
@@ -69,7 +100,18 @@ struct tracer_instance
     struct tracer_connection *server_conn;
     struct tracer *tracer;
     struct wl_list link;
-    struct wl_map map;
+    struct tracer_objects objects;
+    int hup;
+    // tracer_monotonic_time() of the read of the data being handled, the timestamp of its messages
+    uint64_t time;
+    // worker thread handling the instance, NULL for the main thread
+    struct tracer_worker *worker;
+    // messages shown, see tracer_filter_shows(), NULL to show all
+    uint8_t *filter_bits;
+    // message counters of --stats, NULL without
+    struct tracer_stats_counter *stats;
+    // histograms of --latency, NULL without
+    struct tracer_latency_instance *latency;
 };
 
 struct tracer_socket;
@@ -84,9 +126,29 @@ struct tracer_options
 {
     int mode;
     int output_format;
+    int format;
+    const char *decode_file;
     char **spawn_args;
     char *socket;
     const char *outfile;
+    size_t max_buffer_size;
+    int edge_triggered;
+    size_t read_budget;
+    int flush_each_message;
+    int protocol_cache;
+    int workers;
+    int upstream_pool;
+    const char *recorder_file;
+    size_t recorder_size;
+    int recorder_dumps;
+    int async;
+    int async_policy;
+    struct wl_list filter_rule_list;
+    int stats;
+    int stats_top;
+    int latency;
+    const char *latency_json;
+    int clock;
     struct wl_list protocol_file_list;
 };
 
@@ -96,15 +158,41 @@ struct tracer
     int32_t epollfd;
     int next_id;
     struct wl_list instance_list;
+    struct wl_list hup_list;
+    // connections to read again, see tracer_handle_data()
+    struct wl_list ready_list;
+    // server mode: instances waiting for the backlog of the compositor, see tracer_retry_connects()
+    struct wl_list connect_list;
+    // next pass of tracer_shrink_idle() over instance_list
+    uint64_t idle_due;
     struct wl_list protocol_list;
     struct tracer_frontend_interface *frontend;
     void *frontend_data;
+    struct tracer_filter *filter;
+    struct tracer_stats *stats;
+    struct tracer_latency *latency;
     FILE *outfp;
+    struct tracer_writer *writer;
+    int signalfd;
+    // flight recorder, records go there instead of the output when set
+    struct tracer_recorder *recorder;
+    pid_t child_pid;
+    struct tracer_worker_pool *workers;
+    // asynchronous output, records are formatted by a writer thread
+    struct tracer_queue *queue;
+    struct tracer_async *async;
+    // added to the timestamps to print them in wall-clock time
+    int64_t time_offset;
     struct tracer_options *options;
 };
 
 void tracer_print(struct tracer *tracer, const char *fmt, ...);
 void tracer_vprint(struct tracer *tracer, const char *fmt, va_list ap);
+void tracer_output_begin(struct tracer_instance *instance, uint64_t time, uint32_t size);
+void tracer_output_write(struct tracer_instance *instance, const void *data, size_t count);
+void tracer_output_vprintf(struct tracer_instance *instance, const char *fmt, va_list ap);
+void tracer_output_end(struct tracer_instance *instance);
+
 void tracer_log_impl(struct tracer_instance *instance, const char *fmt, ...);
 void tracer_log_cont_impl(struct tracer_instance *instance, const char *fmt, ...);
 void tracer_log_end_impl(struct tracer_instance *instance);
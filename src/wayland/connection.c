@@ -33,6 +33,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include <sys/uio.h>
+#include <sys/ioctl.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -62,22 +63,27 @@ div_roundup(uint32_t n, size_t a)
 // This code implements a ring buffer
 //
 // put some data
-//   [<tail>=0 ... <head> 4095]
+//   [<tail>=0 ... <head> capacity-1]
 // consume some data
-//   [0 <tail> ... <head> 4095]
+//   [0 <tail> ... <head> capacity-1]
 // put additional data: buffer wrap
-//   [0 <head> ... <tail> 4095]
+//   [0 <head> ... <tail> capacity-1]
+//
+// The capacity is a power of two, see ring_buffer_ensure_space() and ring_buffer_shrink()
 
 // not in vanilla
 /*
 struct wl_ring_buffer
 {
-    char data[4096];
+    char *data;
     uint32_t head, tail;
+    uint32_t size_bits, max_size_bits;
+    uint32_t mark, quiet_drains;
+    uint32_t idle_mark;
 };
 */
 
-#define MASK(i) ((i) & 4095)
+#define MASK(b, i) ((i) & (ring_buffer_capacity(b) - 1))
 
 #define MAX_FDS_OUT	28
 #define CLEN		(CMSG_LEN(MAX_FDS_OUT * sizeof(int32_t)))
@@ -90,32 +96,43 @@ struct wl_connection
 {
     struct wl_ring_buffer in, out;
     struct wl_ring_buffer fds_in, fds_out;
+    struct wl_ring_buffer fds_out_pos;
+    uint32_t out_sent;
     int fd;
     int want_flush;
+    int cork;
 };
 */
 
 /**************************************************************************************************/
 
+// not in vanilla
+uint32_t
+ring_buffer_capacity(struct wl_ring_buffer *b)
+{
+    return (uint32_t) 1 << b->size_bits;
+}
+
 static int
 ring_buffer_put(struct wl_ring_buffer *b, const void *data, size_t count)
 {
-    uint32_t head, size;
+    uint32_t head, size, capacity;
 
-    if (count > sizeof(b->data)) {
-        wl_log("Data too big for buffer (%d > %d).\n", count, sizeof(b->data));
+    capacity = ring_buffer_capacity(b);
+    if (count > capacity) {
+        wl_log("Data too big for buffer (%d > %d).\n", count, capacity);
         errno = E2BIG;
         return -1;
     }
 
     // compute head position within b->data, fast modulo
-    head = MASK(b->head);
+    head = MASK(b, b->head);
     // check if data fit in b->data
-    if (head + count <= sizeof b->data) {
+    if (head + count <= capacity) {
         memcpy(b->data + head, data, count);
     }
     else {
-        size = sizeof b->data - head;
+        size = capacity - head;
         memcpy(b->data + head, data, size);
         memcpy(b->data, (const char *) data + size, count - size);
     }
@@ -128,10 +145,11 @@ ring_buffer_put(struct wl_ring_buffer *b, const void *data, size_t count)
 static void
 ring_buffer_put_iov(struct wl_ring_buffer *b, struct iovec *iov, int *count)
 {
-    uint32_t head, tail;
+    uint32_t head, tail, capacity;
 
-    head = MASK(b->head);
-    tail = MASK(b->tail);
+    capacity = ring_buffer_capacity(b);
+    head = MASK(b, b->head);
+    tail = MASK(b, b->tail);
     if (head < tail) {
         iov[0].iov_base = b->data + head;
         iov[0].iov_len = tail - head;
@@ -139,25 +157,28 @@ ring_buffer_put_iov(struct wl_ring_buffer *b, struct iovec *iov, int *count)
     }
     else if (tail == 0) {
         iov[0].iov_base = b->data + head;
-        iov[0].iov_len = sizeof b->data - head;
+        iov[0].iov_len = capacity - head;
         *count = 1;
     }
     else {
         iov[0].iov_base = b->data + head;
-        iov[0].iov_len = sizeof b->data - head;
+        iov[0].iov_len = capacity - head;
         iov[1].iov_base = b->data;
         iov[1].iov_len = tail;
         *count = 2;
     }
 }
 
-static void
+// not in vanilla
+// static
+void
 ring_buffer_get_iov(struct wl_ring_buffer *b, struct iovec *iov, int *count)
 {
-    uint32_t head, tail;
+    uint32_t head, tail, capacity;
 
-    head = MASK(b->head);
-    tail = MASK(b->tail);
+    capacity = ring_buffer_capacity(b);
+    head = MASK(b, b->head);
+    tail = MASK(b, b->tail);
     if (tail < head) {
         iov[0].iov_base = b->data + tail;
         iov[0].iov_len = head - tail;
@@ -165,12 +186,12 @@ ring_buffer_get_iov(struct wl_ring_buffer *b, struct iovec *iov, int *count)
     }
     else if (head == 0) {
         iov[0].iov_base = b->data + tail;
-        iov[0].iov_len = sizeof b->data - tail;
+        iov[0].iov_len = capacity - tail;
         *count = 1;
     }
     else {
         iov[0].iov_base = b->data + tail;
-        iov[0].iov_len = sizeof b->data - tail;
+        iov[0].iov_len = capacity - tail;
         iov[1].iov_base = b->data;
         iov[1].iov_len = head;
         *count = 2;
@@ -182,14 +203,34 @@ ring_buffer_get_iov(struct wl_ring_buffer *b, struct iovec *iov, int *count)
 void
 ring_buffer_copy(struct wl_ring_buffer *b, void *data, size_t count)
 {
-    uint32_t tail, size;
+    uint32_t tail, size, capacity;
+
+    capacity = ring_buffer_capacity(b);
+    tail = MASK(b, b->tail);
+    if (tail + count <= capacity) {
+        memcpy(data, b->data + tail, count);
+    }
+    else {
+        size = capacity - tail;
+        memcpy(data, b->data + tail, size);
+        memcpy((char *) data + size, b->data, count - size);
+    }
+}
+
+// not in vanilla
+// Copy count bytes located at offset from the tail
+static void
+ring_buffer_peek(struct wl_ring_buffer *b, uint32_t offset, void *data, size_t count)
+{
+    uint32_t tail, size, capacity;
 
-    tail = MASK(b->tail);
-    if (tail + count <= sizeof b->data) {
+    capacity = ring_buffer_capacity(b);
+    tail = MASK(b, b->tail + offset);
+    if (tail + count <= capacity) {
         memcpy(data, b->data + tail, count);
     }
     else {
-        size = sizeof b->data - tail;
+        size = capacity - tail;
         memcpy(data, b->data + tail, size);
         memcpy((char *) data + size, b->data, count - size);
     }
@@ -203,6 +244,104 @@ ring_buffer_size(struct wl_ring_buffer *b)
     return b->head - b->tail;
 }
 
+// not in vanilla
+static int
+ring_buffer_init(struct wl_ring_buffer *b, uint32_t max_size_bits)
+{
+    b->data = malloc((size_t) 1 << WL_BUFFER_DEFAULT_SIZE_BITS);
+    if (b->data == NULL)
+        return -1;
+
+    b->head = 0;
+    b->tail = 0;
+    b->size_bits = WL_BUFFER_DEFAULT_SIZE_BITS;
+    b->max_size_bits = max_size_bits;
+    b->mark = 0;
+    b->quiet_drains = 0;
+    b->idle_mark = 0;
+
+    return 0;
+}
+
+// not in vanilla
+// Reallocate the buffer with a capacity of 2^size_bits, pending data is moved to the start
+static int
+ring_buffer_resize(struct wl_ring_buffer *b, uint32_t size_bits)
+{
+    uint32_t size = ring_buffer_size(b);
+    char *data;
+
+    data = malloc((size_t) 1 << size_bits);
+    if (data == NULL)
+        return -1;
+
+    ring_buffer_copy(b, data, size);
+    free(b->data);
+    b->data = data;
+    b->size_bits = size_bits;
+    b->tail = 0;
+    b->head = size;
+    // the quiet drains are counted again at the new capacity
+    b->mark = size;
+    b->quiet_drains = 0;
+
+    return 0;
+}
+
+// not in vanilla
+// Make room for count more bytes, the capacity is doubled until the data fit
+static int
+ring_buffer_ensure_space(struct wl_ring_buffer *b, size_t count)
+{
+    size_t needed = (size_t) ring_buffer_size(b) + count;
+    uint32_t size_bits = b->size_bits;
+
+    if (needed <= ring_buffer_capacity(b))
+        return 0;
+
+    while (((size_t) 1 << size_bits) < needed)
+        size_bits++;
+
+    if (size_bits > b->max_size_bits) {
+        errno = E2BIG;
+        return -1;
+    }
+
+    return ring_buffer_resize(b, size_bits);
+}
+
+// not in vanilla
+// Give back the memory of a burst once the buffer is drained and stays mostly empty. The bytes put
+// since the previous drain bound what the buffer held in between.
+static void
+ring_buffer_shrink(struct wl_ring_buffer *b)
+{
+    if (b->size_bits == WL_BUFFER_DEFAULT_SIZE_BITS || ring_buffer_size(b) != 0)
+        return;
+
+    if (b->head - b->mark <= ring_buffer_capacity(b) / 4)
+        b->quiet_drains++;
+    else
+        b->quiet_drains = 0;
+    b->mark = b->head;
+
+    // on failure we simply keep the larger buffer
+    if (b->quiet_drains >= WL_BUFFER_SHRINK_DRAINS)
+        ring_buffer_resize(b, b->size_bits - 1);
+}
+
+// not in vanilla
+// Give back the memory of an empty buffer which did not see any data since the previous call
+static void
+ring_buffer_shrink_idle(struct wl_ring_buffer *b)
+{
+    if (b->size_bits != WL_BUFFER_DEFAULT_SIZE_BITS && ring_buffer_size(b) == 0 &&
+        b->head == b->idle_mark)
+        ring_buffer_resize(b, WL_BUFFER_DEFAULT_SIZE_BITS);
+
+    b->idle_mark = b->head;
+}
+
 /**************************************************************************************************/
 /**************************************************************************************************/
 
@@ -215,29 +354,90 @@ wl_connection_create(int fd)
     if (connection == NULL)
         return NULL;
 
+    // fd buffers keep the default size, that is 1024 fds
+    if (ring_buffer_init(&connection->in, WL_BUFFER_DEFAULT_MAX_SIZE_BITS) < 0 ||
+        ring_buffer_init(&connection->out, WL_BUFFER_DEFAULT_MAX_SIZE_BITS + 1) < 0 ||
+        ring_buffer_init(&connection->fds_in, WL_BUFFER_DEFAULT_SIZE_BITS) < 0 ||
+        ring_buffer_init(&connection->fds_out, WL_BUFFER_DEFAULT_SIZE_BITS) < 0 ||
+        ring_buffer_init(&connection->fds_out_pos, WL_BUFFER_DEFAULT_SIZE_BITS) < 0) {
+        free(connection->in.data);
+        free(connection->out.data);
+        free(connection->fds_in.data);
+        free(connection->fds_out.data);
+        free(connection->fds_out_pos.data);
+        free(connection);
+        return NULL;
+    }
+
     connection->fd = fd;
 
     return connection;
 }
 
+// not in vanilla
+// Size bits of the input buffer for a maximum buffer size of max_size
+static uint32_t
+input_size_bits(size_t max_size)
+{
+    uint32_t size_bits = WL_BUFFER_DEFAULT_SIZE_BITS;
+
+    // the output buffer is twice as large, its size must fit in 32 bits
+    while (((size_t) 1 << size_bits) < max_size && size_bits < 30)
+        size_bits++;
+
+    // The complete messages are consumed after each read, what is left is the start of a message.
+    // An input buffer which holds the largest message can always be read into, it never fails
+    // with EOVERFLOW when a socket is drained.
+    if (size_bits < WL_BUFFER_MESSAGE_SIZE_BITS)
+        size_bits = WL_BUFFER_MESSAGE_SIZE_BITS;
+
+    return size_bits;
+}
+
+// not in vanilla
+// Set the maximum size of the data buffers, rounded up to a power of two
+void
+wl_connection_set_max_buffer_size(struct wl_connection *connection, size_t max_size)
+{
+    uint32_t size_bits = input_size_bits(max_size);
+
+    connection->in.max_size_bits = size_bits;
+    connection->out.max_size_bits = size_bits + 1;
+}
+
+// not in vanilla
+// Largest amount of messages and fds a read leaves in the input buffers of a connection, for a
+// maximum buffer size of max_size
+size_t
+wl_connection_max_input_size(size_t max_size)
+{
+    return ((size_t) 1 << input_size_bits(max_size)) + ((size_t) 1 << WL_BUFFER_DEFAULT_SIZE_BITS);
+}
+
+// not in vanilla
+// Called periodically, shrinks the buffers of a connection idle since the previous call; a busy
+// connection shrinks as it drains, see ring_buffer_shrink()
+void
+wl_connection_shrink_idle(struct wl_connection *connection)
+{
+    ring_buffer_shrink_idle(&connection->in);
+    ring_buffer_shrink_idle(&connection->out);
+}
+
 static void
 close_fds(struct wl_ring_buffer *buffer, int max)
 {
-    int32_t fds[sizeof(buffer->data) / sizeof(int32_t)], i, count;
-    size_t size;
-
-    size = ring_buffer_size(buffer);
-    if (size == 0)
-        return;
+    int32_t fd;
+    int i, count;
 
-    ring_buffer_copy(buffer, fds, size);
-    count = size / sizeof fds[0];
+    count = ring_buffer_size(buffer) / sizeof fd;
     if (max > 0 && max < count)
         count = max;
-    size = count * sizeof fds[0];
-    for (i = 0; i < count; i++)
-        close(fds[i]);
-    buffer->tail += size;
+    for (i = 0; i < count; i++) {
+        ring_buffer_copy(buffer, &fd, sizeof fd);
+        close(fd);
+        buffer->tail += sizeof fd;
+    }
 }
 
 void
@@ -253,6 +453,11 @@ wl_connection_destroy(struct wl_connection *connection)
 
     close_fds(&connection->fds_out, -1);
     close_fds(&connection->fds_in, -1);
+    free(connection->in.data);
+    free(connection->out.data);
+    free(connection->fds_in.data);
+    free(connection->fds_out.data);
+    free(connection->fds_out_pos.data);
     free(connection);
 
     return fd;
@@ -272,7 +477,9 @@ wl_connection_consume(struct wl_connection *connection, size_t size)
     connection->in.tail += size;
 }
 
-static void
+// Returns the number of fds taken from buffer, at most MAX_FDS_OUT: libwayland receives with a
+// control buffer of that size and closes the fds beyond it
+static int
 build_cmsg(struct wl_ring_buffer *buffer, char *data, size_t *clen)
 {
     struct cmsghdr *cmsg;
@@ -293,6 +500,8 @@ build_cmsg(struct wl_ring_buffer *buffer, char *data, size_t *clen)
     else {
         *clen = 0;
     }
+
+    return size / sizeof(int32_t);
 }
 
 static int
@@ -310,7 +519,7 @@ decode_cmsg(struct wl_ring_buffer *buffer, struct msghdr *msg)
             continue;
 
         size = cmsg->cmsg_len - CMSG_LEN(0);
-        max = sizeof(buffer->data) - ring_buffer_size(buffer);
+        max = ring_buffer_capacity(buffer) - ring_buffer_size(buffer);
         if (size > max || overflow) {
             overflow = 1;
             size /= sizeof(int32_t);
@@ -336,18 +545,34 @@ wl_connection_flush(struct wl_connection *connection)
     struct iovec iov[2];
     struct msghdr msg = { 0 };
     char cmsg[CLEN];
-    int len = 0, count;
+    int len = 0, count, nfds;
     size_t clen;
-    uint32_t tail;
+    uint32_t tail, limit, pos;
 
     if (!connection->want_flush)
         return 0;
 
+    // All the bytes and up to MAX_FDS_OUT fds go in one sendmsg. With more fds queued, the bytes
+    // stop before the message referencing the first fd left out, so that no message arrives
+    // before its fds; at least one byte is sent, the fds can't go alone on a stream socket.
     tail = connection->out.tail;
     while (connection->out.head - connection->out.tail > 0) {
         ring_buffer_get_iov(&connection->out, iov, &count);
 
-        build_cmsg(&connection->fds_out, cmsg, &clen);
+        nfds = build_cmsg(&connection->fds_out, cmsg, &clen);
+
+        if (ring_buffer_size(&connection->fds_out) > nfds * sizeof(int32_t)) {
+            ring_buffer_peek(&connection->fds_out_pos, nfds * sizeof pos, &pos, sizeof pos);
+            limit = pos - connection->out_sent;
+            if (limit == 0)
+                limit = 1;
+            if (iov[0].iov_len >= limit) {
+                iov[0].iov_len = limit;
+                count = 1;
+            }
+            else if (count == 2 && iov[0].iov_len + iov[1].iov_len > limit)
+                iov[1].iov_len = limit - iov[0].iov_len;
+        }
 
         msg.msg_iov = iov;
         msg.msg_iovlen = count;
@@ -361,16 +586,133 @@ wl_connection_flush(struct wl_connection *connection)
         if (len == -1)
             return -1;
 
-        close_fds(&connection->fds_out, MAX_FDS_OUT);
+        if (nfds > 0) {
+            close_fds(&connection->fds_out, nfds);
+            connection->fds_out_pos.tail += nfds * sizeof pos;
+        }
 
         connection->out.tail += len;
+        connection->out_sent += len;
     }
 
     connection->want_flush = 0;
+    ring_buffer_shrink(&connection->out);
 
     return connection->out.head - tail;
 }
 
+// not in vanilla
+// Queue size bytes of the input ring buffer and the received fds in the output buffers of the peer
+static int
+connection_forward_copy(struct wl_connection *connection, struct wl_connection *peer, size_t size)
+{
+    struct iovec iov[2];
+    int32_t fd;
+    int count;
+
+    // the fds are queued first, they belong to the messages that follow
+    while (ring_buffer_size(&connection->fds_in) > 0) {
+        ring_buffer_copy(&connection->fds_in, &fd, sizeof fd);
+        connection->fds_in.tail += sizeof fd;
+        if (wl_connection_put_fd(peer, fd) < 0)
+            return -1;
+    }
+
+    ring_buffer_get_iov(&connection->in, iov, &count);
+    if (iov[0].iov_len >= size) {
+        iov[0].iov_len = size;
+        count = 1;
+    }
+    else
+        iov[1].iov_len = size - iov[0].iov_len;
+
+    if (wl_connection_write(peer, iov[0].iov_base, iov[0].iov_len) < 0)
+        return -1;
+    if (count == 2 && wl_connection_write(peer, iov[1].iov_base, iov[1].iov_len) < 0)
+        return -1;
+    connection->in.tail += size;
+
+    return 0;
+}
+
+// not in vanilla
+// Forward size bytes of the input ring buffer together with all the received fds to the peer.
+//
+// The ring buffer segments are handed directly to sendmsg(), so nothing is copied in user space
+// unless the peer socket is full: the bytes it did not accept are then queued in the output buffer
+// of the peer, to be sent by the next wl_connection_flush().
+int
+wl_connection_forward(struct wl_connection *connection, struct wl_connection *peer, size_t size)
+{
+    struct iovec iov[2];
+    struct msghdr msg = { 0 };
+    char cmsg[CLEN];
+    size_t clen;
+    int len, count;
+
+    // Data already queued for the peer must go first, and fds can't be split from the bytes
+    // referencing them, so these cases take the copy path. A corked peer is flushed later.
+    if (peer->cork || ring_buffer_size(&peer->out) > 0 || ring_buffer_size(&peer->fds_out) > 0 ||
+        ring_buffer_size(&connection->fds_in) > MAX_FDS_OUT * sizeof(int32_t))
+        return connection_forward_copy(connection, peer, size);
+
+    ring_buffer_get_iov(&connection->in, iov, &count);
+    if (iov[0].iov_len >= size) {
+        iov[0].iov_len = size;
+        count = 1;
+    }
+    else
+        iov[1].iov_len = size - iov[0].iov_len;
+
+    build_cmsg(&connection->fds_in, cmsg, &clen);
+
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    msg.msg_control = (clen > 0) ? cmsg : NULL;
+    msg.msg_controllen = clen;
+
+    do {
+        len = sendmsg(peer->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    } while (len == -1 && errno == EINTR);
+
+    if (len == -1) {
+        if (errno != EAGAIN)
+            return -1;
+        return connection_forward_copy(connection, peer, size);
+    }
+
+    // the fds were sent with the first byte, close our copies
+    close_fds(&connection->fds_in, -1);
+    connection->in.tail += len;
+    peer->out_sent += len;
+
+    if ((size_t) len < size)
+        return connection_forward_copy(connection, peer, size - len);
+
+    return 0;
+}
+
+// not in vanilla
+// Return the size of the complete messages at the start of the input buffer. If a header is
+// invalid, the stream can't be split and all the pending data is returned.
+uint32_t
+wl_connection_complete_size(struct wl_connection *connection)
+{
+    uint32_t len, offset, size, header[2];
+
+    len = ring_buffer_size(&connection->in);
+    for (offset = 0; len - offset >= sizeof header; offset += size) {
+        ring_buffer_peek(&connection->in, offset, header, sizeof header);
+        size = header[1] >> 16;
+        if (size < sizeof header)
+            return len;
+        if (len - offset < size)
+            break;
+    }
+
+    return offset;
+}
+
 // Return the size of pending data in the input ring buffer
 uint32_t
 wl_connection_pending_input(struct wl_connection *connection)
@@ -378,20 +720,24 @@ wl_connection_pending_input(struct wl_connection *connection)
     return ring_buffer_size(&connection->in);
 }
 
-int
-wl_connection_read(struct wl_connection *connection)
+// not in vanilla
+// Return the size of the data waiting in the output ring buffer for the socket to accept it
+uint32_t
+wl_connection_pending_output(struct wl_connection *connection)
+{
+    return ring_buffer_size(&connection->out);
+}
+
+// not in vanilla
+// Receive data and fds into the free space of the input ring buffer
+static int
+connection_recvmsg(struct wl_connection *connection)
 {
     struct iovec iov[2];
     struct msghdr msg;
     char cmsg[CLEN];
     int len, count, ret;
 
-    // check ring buffer is not full
-    if (ring_buffer_size(&connection->in) >= sizeof(connection->in.data)) {
-        errno = EOVERFLOW;
-        return -1;
-    }
-
     // setup iov and msg before to read data from socket
     ring_buffer_put_iov(&connection->in, iov, &count);
 
@@ -420,6 +766,43 @@ wl_connection_read(struct wl_connection *connection)
     // update head (no API for that ???)
     connection->in.head += len;
 
+    return len;
+}
+
+int
+wl_connection_read(struct wl_connection *connection)
+{
+    struct wl_ring_buffer *in = &connection->in;
+    uint32_t max_capacity;
+    int len, avail;
+
+    // the previous burst is consumed
+    ring_buffer_shrink(in);
+
+    // grow the ring buffer when it is full
+    if (ring_buffer_ensure_space(in, 1) < 0) {
+        errno = EOVERFLOW;
+        return -1;
+    }
+
+    len = connection_recvmsg(connection);
+    if (len <= 0)
+        return len;
+
+    // The free space was filled, so a burst may still be queued in the socket: grow the buffer to
+    // fit what is pending and read it now rather than on the next wakeup.
+    if (ring_buffer_size(in) == ring_buffer_capacity(in) &&
+        ioctl(connection->fd, FIONREAD, &avail) == 0 && avail > 0) {
+        max_capacity = (uint32_t) 1 << in->max_size_bits;
+        if ((uint32_t) avail > max_capacity - ring_buffer_size(in))
+            avail = max_capacity - ring_buffer_size(in);
+        if (avail > 0 && ring_buffer_ensure_space(in, avail) == 0) {
+            len = connection_recvmsg(connection);
+            if (len < 0 && errno != EAGAIN)
+                return -1;
+        }
+    }
+
     // return the amount of data
     return wl_connection_pending_input(connection);
 }
@@ -427,10 +810,13 @@ wl_connection_read(struct wl_connection *connection)
 int
 wl_connection_write(struct wl_connection *connection, const void *data, size_t count)
 {
-    if (connection->out.head - connection->out.tail + count > ARRAY_LENGTH(connection->out.data)) {
+    // grow the buffer, flush only once it reached its maximum size
+    if (ring_buffer_ensure_space(&connection->out, count) < 0) {
         connection->want_flush = 1;
         if (wl_connection_flush(connection) < 0)
             return -1;
+        if (ring_buffer_ensure_space(&connection->out, count) < 0)
+            return -1;
     }
 
     if (ring_buffer_put(&connection->out, data, count) < 0)
@@ -444,10 +830,12 @@ wl_connection_write(struct wl_connection *connection, const void *data, size_t c
 int
 wl_connection_queue(struct wl_connection *connection, const void *data, size_t count)
 {
-    if (connection->out.head - connection->out.tail + count > ARRAY_LENGTH(connection->out.data)) {
+    if (ring_buffer_ensure_space(&connection->out, count) < 0) {
         connection->want_flush = 1;
         if (wl_connection_flush(connection) < 0)
             return -1;
+        if (ring_buffer_ensure_space(&connection->out, count) < 0)
+            return -1;
     }
 
     return ring_buffer_put(&connection->out, data, count);
@@ -472,17 +860,30 @@ wl_connection_get_fd(struct wl_connection *connection)
     return connection->fd;
 }
 
-// static
+// not in vanilla
+// Queue fd for the message written next, which references it. It is not flushed here: the fds go
+// with the data, as many per sendmsg as the peer accepts, see wl_connection_flush().
 int
 wl_connection_put_fd(struct wl_connection *connection, int32_t fd)
 {
-    if (ring_buffer_size(&connection->fds_out) == MAX_FDS_OUT * sizeof fd) {
+    struct wl_ring_buffer *fds = &connection->fds_out;
+    // a flush moves bytes from the buffer to out_sent, the sum is the position of the next byte
+    uint32_t pos = connection->out_sent + ring_buffer_size(&connection->out);
+
+    if (ring_buffer_size(fds) == ring_buffer_capacity(fds)) {
         connection->want_flush = 1;
-        if (wl_connection_flush(connection) < 0)
+        if (wl_connection_flush(connection) < 0 && errno != EAGAIN)
+            return -1;
+        if (ring_buffer_size(fds) == ring_buffer_capacity(fds)) {
+            errno = EOVERFLOW;
             return -1;
+        }
     }
 
-    return ring_buffer_put(&connection->fds_out, &fd, sizeof fd);
+    ring_buffer_put(fds, &fd, sizeof fd);
+    ring_buffer_put(&connection->fds_out_pos, &pos, sizeof pos);
+
+    return 0;
 }
 
 const char *
@@ -4,23 +4,57 @@
 #ifndef CONNECTION_H
 #define CONNECTION_H
 
+#include <sys/uio.h>
+
+// Ring buffers start with a capacity of 2^WL_BUFFER_DEFAULT_SIZE_BITS bytes and grow in powers of
+// two up to 2^max_size_bits. They shrink back one power of two at a time, once they were drained
+// WL_BUFFER_SHRINK_DRAINS times in a row without holding more than a quarter of their capacity,
+// so a sustained burst keeps its buffer instead of reallocating it on every read. A connection
+// with no traffic at all between two calls to wl_connection_shrink_idle() gets its empty buffers
+// back to the default size at once. The output buffer can hold twice the maximum size: reads stop while it holds more than the maximum size, it has
+// room for a full input buffer above that.
+#define WL_BUFFER_DEFAULT_SIZE_BITS 12
+#define WL_BUFFER_DEFAULT_MAX_SIZE_BITS 20
+// the size of a message is 16 bits
+#define WL_BUFFER_MESSAGE_SIZE_BITS 16
+#define WL_BUFFER_SHRINK_DRAINS 32
+
 struct wl_ring_buffer
 {
-    char data[4096];
+    char *data;
     uint32_t head, tail;
+    uint32_t size_bits, max_size_bits;
+    // head at the last drain, and the number of drains in a row with little data in between
+    uint32_t mark, quiet_drains;
+    // head at the last wl_connection_shrink_idle()
+    uint32_t idle_mark;
 };
 
 uint32_t ring_buffer_size(struct wl_ring_buffer *b);
+uint32_t ring_buffer_capacity(struct wl_ring_buffer *b);
 void ring_buffer_copy(struct wl_ring_buffer *b, void *data, size_t count);
+void ring_buffer_get_iov(struct wl_ring_buffer *b, struct iovec *iov, int *count);
 
 struct wl_connection
 {
     struct wl_ring_buffer in, out;
     struct wl_ring_buffer fds_in, fds_out;
+    // for each fd of fds_out, the position in the output stream of the message referencing it,
+    // counted from out_sent, the number of bytes sent so far
+    struct wl_ring_buffer fds_out_pos;
+    uint32_t out_sent;
     int fd;
     int want_flush;
+    // more data comes before the flush, wl_connection_forward() queues it instead of sending it
+    int cork;
 };
 
 int wl_connection_put_fd(struct wl_connection *connection, int32_t fd);
+void wl_connection_set_max_buffer_size(struct wl_connection *connection, size_t max_size);
+size_t wl_connection_max_input_size(size_t max_size);
+uint32_t wl_connection_complete_size(struct wl_connection *connection);
+uint32_t wl_connection_pending_output(struct wl_connection *connection);
+void wl_connection_shrink_idle(struct wl_connection *connection);
+int wl_connection_forward(struct wl_connection *connection, struct wl_connection *peer, size_t size);
 
 #endif